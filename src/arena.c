@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+arena *
+arena_new(block_size)
+  size_t block_size;
+{
+  arena *a;
+
+  a = (arena *)malloc(sizeof(arena));
+  if (a == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  a->blocks = a->cur = NULL;
+  a->block_size = block_size;
+  return a;
+}
+
+void
+arena_free(a)
+  arena *a;
+{
+  arena_block *block;
+
+  while ((block = a->blocks) != NULL) {
+    a->blocks = block->next;
+    free(block);
+  }
+  free(a);
+}
+
+void
+arena_reset(a)
+  arena *a;
+{
+  arena_block *block;
+
+  for (block = a->blocks; block != NULL; block = block->next)
+    block->used = 0;
+  a->cur = a->blocks;
+}
+
+void *
+arena_alloc(a, len)
+  arena *a;
+  size_t len;
+{
+  arena_block *block, **tail;
+  void *p;
+
+  /* move on to the next kept block, or add one, when this one is full */
+  while (a->cur == NULL || a->cur->size - a->cur->used < len) {
+    if (a->cur != NULL && a->cur->next != NULL) {
+      a->cur = a->cur->next;
+      continue;
+    }
+
+    block = (arena_block *)malloc(sizeof(arena_block) + (len > a->block_size ? len : a->block_size));
+    if (block == NULL) {
+      perror("malloc");
+      return NULL;
+    }
+    block->next = NULL;
+    block->size = len > a->block_size ? len : a->block_size;
+    block->used = 0;
+    for (tail = &a->blocks; *tail != NULL; tail = &(*tail)->next);
+    *tail = block;
+    a->cur = block;
+  }
+
+  p = a->cur->data + a->cur->used;
+  a->cur->used += len;
+  return p;
+}
+
+const char *
+arena_copy(a, s, len)
+  arena *a;
+  const char *s;
+  size_t len;
+{
+  char *p;
+
+  if ((p = (char *)arena_alloc(a, len)) == NULL)
+    return NULL;
+  memcpy(p, s, len);
+  return p;
+}
+
+/* bytes handed out since the last reset */
+size_t
+arena_used(a)
+  arena *a;
+{
+  arena_block *block;
+  size_t used = 0;
+
+  for (block = a->blocks; block != NULL; block = block->next)
+    used += block->used;
+  return used;
+}
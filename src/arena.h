@@ -0,0 +1,30 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK 1048576
+
+typedef struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[];
+} arena_block;
+
+/* bump allocator; everything in it goes away at once on arena_reset(),
+ * which keeps the blocks around for reuse */
+typedef struct {
+  arena_block *blocks;
+  arena_block *cur;
+  size_t block_size;
+} arena;
+
+arena *arena_new(size_t);
+void arena_free(arena *);
+void arena_reset(arena *);
+void *arena_alloc(arena *, size_t);
+const char *arena_copy(arena *, const char *, size_t);
+size_t arena_used(arena *);
+
+#endif
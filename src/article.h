@@ -1,18 +1,26 @@
 #ifndef _ARTICLE_H
 #define _ARTICLE_H
 
+/* a view of one article's headers; the strings aren't NUL-terminated and
+ * belong to whatever decoded them (normally a batch's arena) */
 typedef struct {
   long long article_id;
   long long group_id;
-  char *subject;
+  const char *subject;
   int slen;
-  char *message_id;
+  const char *message_id;
   int mlen;
-  char *poster;
+  const char *poster;
   int plen;
-  char *posted_at;
+  long long poster_id;  /* set on insert */
+  const char *posted_at;
   int wlen;
+  long long posted;   /* posted_at in seconds since the epoch, 0 if unreadable */
   long long bytes;
+  int nlen;           /* file name: the first nlen bytes of the subject */
+  int part;           /* part and total, both 0 without a part counter */
+  int total;
+  long long file_id;  /* set on insert */
 } article;
 
 #endif
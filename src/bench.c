@@ -0,0 +1,1102 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <zlib.h>
+#include "main.h"
+#include "date.h"
+#include "yenc.h"
+#include "decode.h"
+#include "fetch.h"
+#include "group.h"
+#include "conn.h"
+
+#define BENCH_DATES 100000
+/* every measurement is the fastest of BENCH_ROUNDS rounds, each repeating
+ * the stage for at least BENCH_ROUND seconds */
+#define BENCH_ROUNDS 3
+#define BENCH_ROUND 0.05
+#define BENCH_RESULTS 256
+#define BENCH_THRESHOLD 10.0
+#define BENCH_FIRST 1000001LL
+/* made-up streams the vector yEnc decoders are checked on, and the
+ * longest of them */
+#define BENCH_CHECKS 200000
+#define BENCH_CHECK_LEN 300
+
+/* one set of replies to run the stages over, either made up or read from
+ * a file */
+typedef struct {
+  char name[64];
+  int count;                /* articles in it */
+  long long low;
+  long long high;
+  char *wire;               /* a compressed data block, as received */
+  size_t wlen;
+  int overview;             /* wire and plain hold overview records */
+  char *plain;              /* the same records uncompressed */
+  size_t plen;
+  char *hdr[NUM_HEADERS];   /* compressed XZHDR data blocks */
+  size_t hlen[NUM_HEADERS];
+  char *groups;             /* GROUP replies, one per line */
+  size_t glen;
+} bench_corpus;
+
+typedef struct {
+  char stage[32];
+  char corpus[64];
+  double ns;                /* per article */
+  double mbps;
+} bench_result;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} bench_buffer;
+
+/* scratch space shared by the stages */
+static nntp_decoder *dec;
+static arena *ar;
+static article *articles;
+static int articles_size;
+static unsigned char *scratch;
+static size_t scratch_size;
+
+static bench_result results[BENCH_RESULTS];
+static int num_results = 0;
+
+static void bench_record(const char *, const char *, double, double);
+
+
+static double
+bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Date headers as posters write them; strptime() can only be given one
+ * format, so the comparison uses the RFC 5322 one */
+static char **
+bench_dates(n)
+  int n;
+{
+  static const char *zones[] = { "+0000", "-0500", "+0200", "GMT" };
+  char **dates, buf[64];
+  time_t t;
+  struct tm tm;
+  int i;
+
+  if ((dates = (char **)malloc(sizeof(char *) * n)) == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  for (i = 0; i < n; i++) {
+    t = 1000000000 + (time_t)i * 7919;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S ", &tm);
+    strcat(buf, zones[i % 4]);
+    dates[i] = strdup(buf);
+  }
+  return dates;
+}
+
+static long long
+bench_strptime(s)
+  const char *s;
+{
+  struct tm tm;
+  const char *end;
+  long long t;
+
+  memset(&tm, 0, sizeof(tm));
+  if ((end = strptime(s, "%a, %d %b %Y %H:%M:%S", &tm)) == NULL)
+    return 0;
+  t = timegm(&tm);
+  /* glibc's %z doesn't take zone names, so do the offset by hand */
+  while (*end == ' ')
+    end++;
+  if (*end == '+' || *end == '-')
+    t -= (*end == '-' ? -1 : 1) * ((end[1] - '0') * 36000 + (end[2] - '0') * 3600 + (end[3] - '0') * 600 + (end[4] - '0') * 60);
+  return t;
+}
+
+static int
+bench_date(iterations)
+  int iterations;
+{
+  char **dates;
+  int i, j, *lens;
+  long long t, sum = 0, check = 0, bytes;
+  double start, parse_time, strptime_time;
+
+  if ((dates = bench_dates(BENCH_DATES)) == NULL)
+    return 1;
+  lens = (int *)malloc(sizeof(int) * BENCH_DATES);
+  for (i = 0; i < BENCH_DATES; i++)
+    lens[i] = strlen(dates[i]);
+
+  for (i = 0; i < BENCH_DATES; i++) {
+    if (!date_parse(dates[i], lens[i], &t) || t != bench_strptime(dates[i])) {
+      fprintf(stderr, "date_parse() and strptime() disagree on %s\n", dates[i]);
+      return 1;
+    }
+  }
+
+  start = bench_now();
+  for (j = 0; j < iterations; j++)
+    for (i = 0; i < BENCH_DATES; i++)
+      if (date_parse(dates[i], lens[i], &t))
+        sum += t;
+  parse_time = bench_now() - start;
+
+  start = bench_now();
+  for (j = 0; j < iterations; j++)
+    for (i = 0; i < BENCH_DATES; i++)
+      check += bench_strptime(dates[i]);
+  strptime_time = bench_now() - start;
+
+  if (sum != check) {
+    fprintf(stderr, "date_parse() and strptime() sums differ\n");
+    return 1;
+  }
+  for (i = 0, bytes = 0; i < BENCH_DATES; i++)
+    bytes += lens[i];
+  bench_record("date", "rfc5322", parse_time * 1e9 / ((double)iterations * BENCH_DATES),
+      bytes * (double)iterations / parse_time / 1e6);
+  bench_record("strptime", "rfc5322", strptime_time * 1e9 / ((double)iterations * BENCH_DATES),
+      bytes * (double)iterations / strptime_time / 1e6);
+
+  for (i = 0; i < BENCH_DATES; i++)
+    free(dates[i]);
+  free(dates);
+  free(lens);
+  return 0;
+}
+
+static unsigned long long
+bench_hash(x)
+  unsigned long long x;
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static int
+bench_reserve(buf, len)
+  bench_buffer *buf;
+  size_t len;
+{
+  char *data;
+  size_t size;
+
+  if (buf->len + len + 1 <= buf->size)
+    return 0;
+  for (size = buf->size > 0 ? buf->size : 65536; size < buf->len + len + 1; size *= 2);
+  if ((data = (char *)realloc(buf->data, size)) == NULL) {
+    perror("realloc");
+    return 1;
+  }
+  buf->data = data;
+  buf->size = size;
+  return 0;
+}
+
+static int
+bench_append(buf, s, len)
+  bench_buffer *buf;
+  const char *s;
+  size_t len;
+{
+  if (bench_reserve(buf, len) != 0)
+    return 1;
+  memcpy(buf->data + buf->len, s, len);
+  buf->len += len;
+  buf->data[buf->len] = 0;
+  return 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* a made-up yEnc stream of len bytes for the decoder check: plain bytes,
+ * with escapes, line ends, dot-stuffed line starts and "=yend" trailers
+ * put mostly on and around the vector decoders' 16 and 32 byte lanes */
+static void
+bench_yenc_stream(buf, len, seed)
+  char *buf;
+  size_t len;
+  unsigned long long seed;
+{
+  static const char *tokens[] = { "=", "\r\n", "\r\n.", "\r\n=yend size=1", "\r", "\n", "==", "=\r\n" };
+  unsigned long long x;
+  size_t i, pos, n, specials;
+  const char *t;
+  char c;
+
+  for (i = 0; i < len; i++) {
+    x = bench_hash(seed * 1000003 + i);
+    c = (char)(x & 0xff);
+    buf[i] = c == '=' || c == '\r' || c == '\n' ? (char)(c + 1) : c;
+  }
+  specials = len / 8 + 1;
+  for (i = 0; i < specials; i++) {
+    x = bench_hash(seed ^ (0x5bd1e995ULL * (i + 1)));
+    pos = x % 4 == 0 ? (size_t)(x >> 8) % (len + 1) : 16 * ((size_t)(x >> 8) % (len / 16 + 1)) + (x >> 4) % 4 - 2;
+    if (pos >= len)
+      continue;
+    t = tokens[(x >> 32) % (sizeof(tokens) / sizeof(tokens[0]))];
+    for (n = 0; t[n] != 0 && pos + n < len; n++)
+      buf[pos + n] = t[n];
+    /* an escape takes any byte after it */
+    if (t[0] == '=' && t[1] == 0 && pos + 1 < len)
+      buf[pos + 1] = (char)(x >> 40);
+  }
+}
+
+/* decode made-up streams with the vector decoders this CPU has and make
+ * sure they come out byte for byte the same as the scalar one; returns 1
+ * if one differs */
+static int
+bench_yenc_check()
+{
+  static const struct {
+    const char *name;
+    yenc_decoder decode;
+  } impls[] = {
+    { "yenc-sse2", yenc_decode_sse2 },
+    { "yenc-avx2", yenc_decode_avx2 }
+  };
+  char buf[BENCH_CHECK_LEN];
+  unsigned char want[BENCH_CHECK_LEN], got[BENCH_CHECK_LEN];
+  size_t len, want_len, got_len, want_used, got_used;
+  int i, round, want_end, got_end;
+
+  __builtin_cpu_init();
+  for (i = 0; i < 2; i++) {
+    if (!(i == 0 ? __builtin_cpu_supports("sse2") : __builtin_cpu_supports("avx2")))
+      continue;
+    for (round = 0; round < BENCH_CHECKS; round++) {
+      len = (size_t)bench_hash(round) % BENCH_CHECK_LEN;
+      bench_yenc_stream(buf, len, (unsigned long long)round);
+      want_len = yenc_decode_scalar(want, buf, len, &want_used, &want_end);
+      got_len = impls[i].decode(got, buf, len, &got_used, &got_end);
+      if (got_len != want_len || got_used != want_used || got_end != want_end || memcmp(got, want, want_len) != 0) {
+        fprintf(stderr, "%s and yenc-scalar differ on stream %d (%lu bytes): %lu/%lu/%d against %lu/%lu/%d\n",
+            impls[i].name, round, (unsigned long)len, (unsigned long)got_len, (unsigned long)got_used, got_end,
+            (unsigned long)want_len, (unsigned long)want_used, want_end);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+#endif
+
+/* raw deflate at level, then yEnc, the way XZHDR and XZVER replies come;
+ * the result is NUL-terminated for nntp_decode_headers() */
+static char *
+bench_compress(in, len, level, out_len)
+  const char *in;
+  size_t len;
+  int level;
+  size_t *out_len;
+{
+  z_stream strm;
+  unsigned char *z;
+  char *out;
+  size_t zlen, n;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+  zlen = deflateBound(&strm, len);
+  if ((z = (unsigned char *)malloc(zlen)) == NULL) {
+    perror("malloc");
+    deflateEnd(&strm);
+    return NULL;
+  }
+  strm.next_in = (unsigned char *)in;
+  strm.avail_in = len;
+  strm.next_out = z;
+  strm.avail_out = zlen;
+  if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&strm);
+    free(z);
+    return NULL;
+  }
+  zlen = strm.total_out;
+  deflateEnd(&strm);
+
+  if ((out = (char *)malloc(zlen * 2 + (zlen / 128 + 1) * 2 + 256)) == NULL) {
+    perror("malloc");
+    free(z);
+    return NULL;
+  }
+  n = strlen(YENC_LINE);
+  memcpy(out, YENC_LINE, n);
+  n += yenc_encode(out + n, z, zlen, 128);
+  n += sprintf(out + n, "\r\n=yend size=%lu part=0 pcrc32=00000000\r\n", (unsigned long)zlen);
+  free(z);
+  *out_len = n;
+  return out;
+}
+
+/* subject of article i in one of the synthetic styles; kana ones are
+ * katakana, whose UTF-8 lead byte 0xe3 is one yEnc has to escape */
+static int
+bench_subject(style, i, h, out)
+  const char *style;
+  int i;
+  unsigned long long h;
+  char *out;
+{
+  static const char *words[] = {
+    "Complete", "Season", "Remastered", "Collection", "Extended", "Edition",
+    "Director's", "Cut", "Original", "Soundtrack", "Uncut", "Archive"
+  };
+  int len = 0, j, part = i % 50 + 1, file = i / 50, k;
+
+  if (strcmp(style, "short") == 0)
+    return sprintf(out, "f%05d.r%02d yEnc (1/%d)", file, part, (int)(h % 200) + 1);
+  if (strcmp(style, "long") == 0) {
+    for (j = 0; len < 200; j++)
+      len += sprintf(out + len, "%s ", words[(h >> (j % 16 * 4)) % 12]);
+  }
+  if (strcmp(style, "kana") == 0) {
+    len += sprintf(out + len, "[%02d/50] - \"", part);
+    for (j = 0; j < 16; j++) {
+      k = 0x30a1 + (int)((h >> (j * 4)) % 86);
+      out[len++] = (char)(0xe0 | (k >> 12));
+      out[len++] = (char)(0x80 | ((k >> 6) & 0x3f));
+      out[len++] = (char)(0x80 | (k & 0x3f));
+    }
+    return len + sprintf(out + len, ".part%02d.rar\" yEnc (1/%d)", part, (int)(h % 200) + 1);
+  }
+  return len + sprintf(out + len, "[%02d/50] - \"Some.Release.Name.%04d.1080p.WEB.x264-GRP.part%02d.rar\" yEnc (1/%d)",
+      part, file % 10000, part, (int)(h % 200) + 1);
+}
+
+/* value of header field j (in headers[] order) for article i */
+static int
+bench_field(style, j, i, out)
+  const char *style;
+  int j;
+  int i;
+  char *out;
+{
+  static const char *zones[] = { "+0000", "-0500", "+0200", "GMT" };
+  unsigned long long h = bench_hash(i);
+  time_t t;
+  struct tm tm;
+  int len;
+
+  switch (j) {
+  case 0:
+    return bench_subject(style, i, h, out);
+  case 1:
+    return sprintf(out, "<%016llx$part%d@news.example.com>", h, i % 50 + 1);
+  case 2:
+    return sprintf(out, "poster%03d <poster%03d@example.com>", (int)(h % 500), (int)(h % 500));
+  case 3:
+    t = 1500000000 + (time_t)i * 7;
+    gmtime_r(&t, &tm);
+    len = strftime(out, 64, "%a, %d %b %Y %H:%M:%S ", &tm);
+    return len + sprintf(out + len, "%s", zones[i % 4]);
+  default:
+    return sprintf(out, "%llu", 700000 + h % 50000);
+  }
+}
+
+/* count articles of a style into c: an XZHDR block per field, and the
+ * overview both as XZVER and as XOVER would send it.  The kana style is
+ * stored rather than deflated, so its escape density is the subjects' own.
+ * Only the typical style gets GROUP replies, which don't depend on it */
+static int
+bench_synthetic(c, style, count)
+  bench_corpus *c;
+  const char *style;
+  int count;
+{
+  bench_buffer fields[NUM_HEADERS], over, groups;
+  char value[NUM_HEADERS][1024], rec[4096];
+  int i, j, len[NUM_HEADERS], n, level = strcmp(style, "kana") == 0 ? 0 : Z_DEFAULT_COMPRESSION;
+
+  memset(c, 0, sizeof(*c));
+  memset(fields, 0, sizeof(fields));
+  memset(&over, 0, sizeof(over));
+  memset(&groups, 0, sizeof(groups));
+  snprintf(c->name, sizeof(c->name), "%s/%d", style, count);
+  c->count = count;
+  c->low = BENCH_FIRST;
+  c->high = BENCH_FIRST + count - 1;
+  c->overview = 1;
+
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < NUM_HEADERS; j++) {
+      len[j] = bench_field(style, j, i, value[j]);
+      n = sprintf(rec, "%lld %.*s\r\n", BENCH_FIRST + i, len[j], value[j]);
+      if (bench_append(&fields[j], rec, n) != 0)
+        return 1;
+    }
+    /* number, subject, from, date, message-id, references, bytes, lines */
+    n = sprintf(rec, "%lld\t%.*s\t%.*s\t%.*s\t%.*s\t\t%.*s\t%d\r\n", BENCH_FIRST + i,
+        len[0], value[0], len[2], value[2], len[3], value[3], len[1], value[1], len[4], value[4], 5000);
+    if (bench_append(&over, rec, n) != 0)
+      return 1;
+    if (strcmp(style, "typical") != 0)
+      continue;
+    n = sprintf(rec, "%d %lld %lld alt.binaries.bench.%s.%d\n", (int)(bench_hash(i) % 1000000),
+        BENCH_FIRST, BENCH_FIRST + (long long)(bench_hash(i) % 100000000), style, i);
+    if (bench_append(&groups, rec, n) != 0)
+      return 1;
+  }
+
+  for (j = 0; j < NUM_HEADERS; j++) {
+    c->hdr[j] = bench_compress(fields[j].data, fields[j].len, level, &c->hlen[j]);
+    free(fields[j].data);
+    if (c->hdr[j] == NULL)
+      return 1;
+  }
+  if ((c->wire = bench_compress(over.data, over.len, level, &c->wlen)) == NULL)
+    return 1;
+  c->plain = over.data;
+  c->plen = over.len;
+  c->groups = groups.data;
+  c->glen = groups.len;
+  return 0;
+}
+
+typedef struct {
+  long long low;
+  long long high;
+  int count;
+  int tabs;
+} bench_survey;
+
+static void
+bench_survey_record(arg, rec, len)
+  void *arg;
+  const char *rec;
+  size_t len;
+{
+  bench_survey *s = (bench_survey *)arg;
+  long long id = strtoll(rec, NULL, 10);
+
+  if (s->count == 0 || id < s->low)
+    s->low = id;
+  if (s->count == 0 || id > s->high)
+    s->high = id;
+  s->count++;
+  if (memchr(rec, '\t', len) != NULL)
+    s->tabs = 1;
+}
+
+/* a recorded reply data block, as it came off the wire and without the
+ * terminating ".\r\n": either an XZHDR/XZVER block starting at =ybegin, or
+ * XHDR/XOVER records.  Overview is told apart by its tabs; anything else
+ * is parsed as the hdr header */
+static int
+bench_recorded(c, file, hdr)
+  bench_corpus *c;
+  const char *file;
+  int hdr;
+{
+  FILE *f;
+  bench_buffer buf;
+  bench_survey s;
+  char chunk[65536];
+  const char *base;
+  size_t n;
+  int res = 0;
+
+  memset(c, 0, sizeof(*c));
+  memset(&buf, 0, sizeof(buf));
+  memset(&s, 0, sizeof(s));
+  if ((f = fopen(file, "r")) == NULL) {
+    perror(file);
+    return 1;
+  }
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    if (bench_append(&buf, chunk, n) != 0) {
+      fclose(f);
+      return 1;
+    }
+  fclose(f);
+  if (buf.len >= 3 && memcmp(buf.data + buf.len - 3, ".\r\n", 3) == 0 && (buf.len == 3 || buf.data[buf.len - 4] == '\n'))
+    buf.len -= 3;
+
+  base = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+  snprintf(c->name, sizeof(c->name), "%s", base);
+  if (buf.len >= 7 && memcmp(buf.data, "=ybegin", 7) == 0) {
+    res = nntp_decoder_reset(dec);
+    if (res == 0)
+      res = nntp_decoder_feed(dec, buf.data, buf.len, bench_survey_record, &s);
+    if (res == 0)
+      res = nntp_decoder_finish(dec);
+    c->wire = buf.data;
+    c->wlen = buf.len;
+  }
+  else {
+    nntp_records_feed(buf.data, buf.len, bench_survey_record, &s);
+    c->plain = buf.data;
+    c->plen = buf.len;
+  }
+  if (res != 0 || s.count == 0) {
+    fprintf(stderr, "%s: no records found\n", file);
+    return 1;
+  }
+  c->count = s.count;
+  c->low = s.low;
+  c->high = s.high;
+  c->overview = s.tabs;
+  if (!s.tabs) {
+    c->hdr[hdr] = c->wire != NULL ? c->wire : c->plain;
+    c->hlen[hdr] = c->wire != NULL ? c->wlen : c->plen;
+  }
+  return 0;
+}
+
+static void
+bench_corpus_free(c)
+  bench_corpus *c;
+{
+  int j;
+
+  for (j = 0; j < NUM_HEADERS; j++)
+    if (c->hdr[j] != c->wire && c->hdr[j] != c->plain)
+      free(c->hdr[j]);
+  free(c->wire);
+  free(c->plain);
+  free(c->groups);
+}
+
+/* make room for the articles of c; returns nonzero on failure */
+static int
+bench_prepare(c)
+  bench_corpus *c;
+{
+  unsigned char *s;
+  article *a;
+  size_t size = c->wlen + c->plen + 4;
+
+  if (c->count > articles_size) {
+    if ((a = (article *)realloc(articles, sizeof(article) * c->count)) == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    articles = a;
+    articles_size = c->count;
+  }
+  if (size > scratch_size) {
+    if ((s = (unsigned char *)realloc(scratch, size)) == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    scratch = s;
+    scratch_size = size;
+  }
+  return 0;
+}
+
+/* the stages; each runs once over c and returns the bytes it went
+ * through, 0 if it doesn't apply to c, or -1 on failure */
+
+static long long
+stage_yenc(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  yenc_decoder decode = (yenc_decoder)arg;
+  const char *body;
+  size_t consumed;
+  int end = 0;
+
+  if (c->wire == NULL || (body = memchr(c->wire, '\n', c->wlen)) == NULL)
+    return 0;
+  body++;
+  decode(scratch, body, c->wlen - (body - c->wire), &consumed, &end);
+  return end ? (long long)c->wlen : -1;
+}
+
+static long long
+stage_decode(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  char *out;
+
+  if (c->wire == NULL)
+    return 0;
+  c->wire[c->wlen] = 0;
+  if ((out = nntp_decode_headers(c->wire)) == NULL)
+    return -1;
+  free(out);
+  return c->wlen;
+}
+
+static void
+bench_count_record(arg, rec, len)
+  void *arg;
+  const char *rec;
+  size_t len;
+{
+  (*(int *)arg)++;
+}
+
+static long long
+stage_feed(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  int count = 0, res;
+
+  if (c->wire == NULL)
+    return 0;
+  res = nntp_decoder_reset(dec);
+  if (res == 0)
+    res = nntp_decoder_feed(dec, c->wire, c->wlen, bench_count_record, &count);
+  if (res == 0)
+    res = nntp_decoder_finish(dec);
+  return res == 0 && count == c->count ? (long long)c->wlen : -1;
+}
+
+static long long
+stage_headers(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  long long bytes = 0;
+  int j, update = 0;
+
+  arena_reset(ar);
+  for (j = 0; j < NUM_HEADERS; j++) {
+    if (c->hdr[j] == NULL)
+      continue;
+    if (decode_headers(c->hdr[j] == c->plain ? NULL : dec, c->hdr[j], c->hlen[j], articles, ar, headers[j],
+        c->low, c->high, 1, update) != c->count)
+      return -1;
+    bytes += c->hlen[j];
+    update = 1;
+  }
+  return bytes;
+}
+
+static long long
+stage_overview(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  int compressed = arg != NULL;
+  char *data = compressed ? c->wire : c->plain;
+  size_t len = compressed ? c->wlen : c->plen;
+
+  if (!c->overview || data == NULL)
+    return 0;
+  arena_reset(ar);
+  if (decode_overview(dec, data, len, articles, ar, compressed, c->low, c->high, 1) != c->count)
+    return -1;
+  return len;
+}
+
+static long long
+stage_group(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  char *line = c->groups, *eol;
+  nntp_group *g;
+
+  if (line == NULL)
+    return 0;
+  while ((eol = strchr(line, '\n')) != NULL) {
+    *eol = 0;
+    g = nntp_group_new(line);
+    *eol = '\n';
+    if (g->high < g->low)
+      return -1;
+    nntp_group_free(g);
+    line = eol + 1;
+  }
+  return c->glen;
+}
+
+/* the receive buffer of a connection that has the whole block in it
+ * already, so only the scanning is measured */
+static nntp_conn *
+bench_conn(c, conn)
+  bench_corpus *c;
+  nntp_conn *conn;
+{
+  const char *data = c->wire != NULL ? c->wire : c->plain;
+  size_t len = c->wire != NULL ? c->wlen : c->plen;
+
+  if (data == NULL)
+    return NULL;
+  memset(conn, 0, sizeof(*conn));
+  conn->buf = (char *)scratch;
+  memcpy(conn->buf, data, len);
+  memcpy(conn->buf + len, ".\r\n", 3);
+  conn->buf_size = conn->buf_len = len + 3;
+  return conn;
+}
+
+static long long
+stage_scan(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  nntp_conn conn;
+  char *block;
+
+  if (bench_conn(c, &conn) == NULL)
+    return 0;
+  if ((block = nntp_read_block(&conn)) == NULL)
+    return -1;
+  free(block);
+  return conn.buf_size;
+}
+
+static long long
+stage_chunk(c, arg)
+  bench_corpus *c;
+  void *arg;
+{
+  nntp_conn conn;
+  size_t len;
+  int last = 0;
+
+  if (bench_conn(c, &conn) == NULL)
+    return 0;
+  while (!last)
+    if (nntp_read_chunk(&conn, &len, &last) == NULL)
+      return -1;
+  return conn.buf_size;
+}
+
+typedef struct {
+  const char *name;
+  long long (*run)(bench_corpus *, void *);
+  void *arg;
+} bench_stage;
+
+static bench_stage stages[] = {
+  { "yenc-scalar", stage_yenc, (void *)yenc_decode_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+  { "yenc-sse2", stage_yenc, (void *)yenc_decode_sse2 },
+  { "yenc-avx2", stage_yenc, (void *)yenc_decode_avx2 },
+#endif
+  { "decode", stage_decode, NULL },
+  { "feed", stage_feed, NULL },
+  { "headers", stage_headers, NULL },
+  { "overview", stage_overview, (void *)1 },
+  { "xover", stage_overview, NULL },
+  { "scan", stage_scan, NULL },
+  { "chunk", stage_chunk, NULL },
+  { "group", stage_group, NULL },
+  { NULL, NULL, NULL }
+};
+
+/* whether stage name was asked for; a filter also matches the stages it
+ * is a prefix of, so "yenc" runs all of them */
+static int
+bench_wanted(filter, name)
+  const char *filter;
+  const char *name;
+{
+  return filter == NULL || strncmp(filter, name, strlen(filter)) == 0;
+}
+
+static int
+bench_supported(s)
+  bench_stage *s;
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (s->arg == (void *)yenc_decode_sse2)
+    return __builtin_cpu_supports("sse2");
+  if (s->arg == (void *)yenc_decode_avx2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+static void
+bench_record(stage, corpus, ns, mbps)
+  const char *stage;
+  const char *corpus;
+  double ns;
+  double mbps;
+{
+  bench_result *r;
+
+  if (num_results == BENCH_RESULTS)
+    return;
+  r = &results[num_results++];
+  snprintf(r->stage, sizeof(r->stage), "%s", stage);
+  snprintf(r->corpus, sizeof(r->corpus), "%s", corpus);
+  r->ns = ns;
+  r->mbps = mbps;
+}
+
+/* time stage s over c; returns 1 if it failed */
+static int
+bench_run(s, c)
+  bench_stage *s;
+  bench_corpus *c;
+{
+  long long bytes;
+  double start, elapsed, best = 0;
+  int round, runs;
+
+  if ((bytes = s->run(c, s->arg)) <= 0) {
+    if (bytes < 0)
+      fprintf(stderr, "%s failed on %s\n", s->name, c->name);
+    return bytes < 0;
+  }
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    start = bench_now();
+    runs = 0;
+    do {
+      s->run(c, s->arg);
+      runs++;
+    } while ((elapsed = bench_now() - start) < BENCH_ROUND);
+    if (round == 0 || elapsed / runs < best)
+      best = elapsed / runs;
+  }
+  bench_record(s->name, c->name, best * 1e9 / c->count, bytes / best / 1e6);
+  return 0;
+}
+
+static int
+bench_corpus_run(c, filter)
+  bench_corpus *c;
+  const char *filter;
+{
+  bench_stage *s;
+
+  if (bench_prepare(c) != 0)
+    return 1;
+  for (s = stages; s->name != NULL; s++)
+    if (bench_wanted(filter, s->name) && bench_supported(s) && bench_run(s, c) != 0)
+      return 1;
+  return 0;
+}
+
+/* read a baseline written by -w; returns the number of results in it */
+static int
+bench_load(file, base, size)
+  const char *file;
+  bench_result *base;
+  int size;
+{
+  FILE *f;
+  char line[256];
+  int n = 0;
+
+  if ((f = fopen(file, "r")) == NULL) {
+    perror(file);
+    return -1;
+  }
+  while (n < size && fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%31s %63s %lf %lf", base[n].stage, base[n].corpus, &base[n].ns, &base[n].mbps) == 4)
+      n++;
+  }
+  fclose(f);
+  return n;
+}
+
+static int
+bench_save(file)
+  const char *file;
+{
+  FILE *f;
+  int i;
+
+  if ((f = fopen(file, "w")) == NULL) {
+    perror(file);
+    return 1;
+  }
+  fprintf(f, "# stage corpus ns/article MB/s\n");
+  for (i = 0; i < num_results; i++)
+    fprintf(f, "%s %s %.3f %.3f\n", results[i].stage, results[i].corpus, results[i].ns, results[i].mbps);
+  if (fclose(f) != 0) {
+    perror(file);
+    return 1;
+  }
+  return 0;
+}
+
+/* print the results, against the baseline if there is one; returns the
+ * number of stages that got more than threshold percent slower */
+static int
+bench_report(base, num_base, threshold)
+  bench_result *base;
+  int num_base;
+  double threshold;
+{
+  int i, j, slower = 0;
+  double change;
+
+  printf("%-12s %-24s %12s %10s%s\n", "stage", "corpus", "ns/article", "MB/s", num_base > 0 ? "   baseline" : "");
+  for (i = 0; i < num_results; i++) {
+    printf("%-12s %-24s %12.1f %10.1f", results[i].stage, results[i].corpus, results[i].ns, results[i].mbps);
+    for (j = 0; j < num_base; j++)
+      if (strcmp(base[j].stage, results[i].stage) == 0 && strcmp(base[j].corpus, results[i].corpus) == 0)
+        break;
+    if (j < num_base) {
+      change = (results[i].ns / base[j].ns - 1) * 100;
+      printf("   %+7.1f%%%s", change, change > threshold ? "  SLOWER" : "");
+      if (change > threshold)
+        slower++;
+    }
+    printf("\n");
+  }
+  fflush(stdout);
+  return slower;
+}
+
+static void
+usage(prog)
+  const char *prog;
+{
+  fprintf(stderr, "Usage: %s [-k] [-s STAGE] [-b BATCH] [-r FILE [-H HEADER]] [-w BASELINE | -c BASELINE [-t PERCENT]] [ITERATIONS]\n", prog);
+  fprintf(stderr, "  -k  only check the vector yEnc decoders against the scalar one\n");
+  fprintf(stderr, "  -s  only run stages starting with STAGE (yenc, decode, feed, headers,\n");
+  fprintf(stderr, "      overview, xover, scan, chunk, group, date)\n");
+  fprintf(stderr, "  -b  articles per synthetic corpus, instead of 1000, 10000 and 50000\n");
+  fprintf(stderr, "  -r  run over a recorded reply data block instead; repeatable\n");
+  fprintf(stderr, "  -H  header the recorded XZHDR/XHDR blocks are of (default Subject)\n");
+  fprintf(stderr, "  -w  write the results to BASELINE\n");
+  fprintf(stderr, "  -c  compare with BASELINE; fails if a stage is PERCENT (default %.0f) slower\n", BENCH_THRESHOLD);
+  fprintf(stderr, "  ITERATIONS passes over %d dates for the date stage (default 10)\n", BENCH_DATES);
+}
+
+int
+main(argc, argv)
+  int argc;
+  char *argv[];
+{
+  static const char *styles[] = { "short", "typical", "long", "kana" };
+  static const int batches[] = { 1000, 10000, 50000 };
+  const char *filter = NULL, *save = NULL, *compare = NULL, *recorded[16];
+  bench_result base[BENCH_RESULTS];
+  bench_corpus c;
+  double threshold = BENCH_THRESHOLD;
+  int iterations = 10, batch = 0, num_recorded = 0, num_base = 0, hdr = 0;
+  int opt, i, j, res = 0, check_only = 0;
+
+  while ((opt = getopt(argc, argv, "ks:b:r:H:w:c:t:")) != -1) {
+    switch (opt) {
+    case 'k':
+      check_only = 1;
+      break;
+    case 's':
+      filter = optarg;
+      break;
+    case 'b':
+      if ((batch = atoi(optarg)) < 1) {
+        fprintf(stderr, "Bad batch size: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'r':
+      if (num_recorded == 16) {
+        fprintf(stderr, "Too many recorded corpora.\n");
+        return 1;
+      }
+      recorded[num_recorded++] = optarg;
+      break;
+    case 'H':
+      for (hdr = 0; headers[hdr] != NULL && strcasecmp(headers[hdr], optarg) != 0; hdr++);
+      if (headers[hdr] == NULL) {
+        fprintf(stderr, "Unknown header: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'w':
+      save = optarg;
+      break;
+    case 'c':
+      compare = optarg;
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind > 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (argc - optind == 1 && (iterations = atoi(argv[optind])) < 1) {
+    fprintf(stderr, "Bad number of iterations: %s\n", argv[optind]);
+    return 1;
+  }
+  if (compare != NULL && (num_base = bench_load(compare, base, BENCH_RESULTS)) < 0)
+    return 1;
+
+  /* timings of a vector decoder that gets it wrong are no use */
+#if defined(__x86_64__) || defined(__i386__)
+  if ((check_only || bench_wanted(filter, "yenc-sse2") || bench_wanted(filter, "yenc-avx2")) && bench_yenc_check() != 0)
+    return 1;
+#endif
+  if (check_only) {
+    printf("yEnc decoders agree on %d streams\n", BENCH_CHECKS);
+    return 0;
+  }
+
+  if ((dec = nntp_decoder_new()) == NULL || (ar = arena_new(ARENA_BLOCK)) == NULL)
+    return 1;
+
+  if (num_recorded > 0) {
+    for (i = 0; res == 0 && i < num_recorded; i++) {
+      if (bench_recorded(&c, recorded[i], hdr) != 0)
+        return 1;
+      res = bench_corpus_run(&c, filter);
+      bench_corpus_free(&c);
+    }
+  }
+  else {
+    /* batch sizes on the typical subjects, the other styles at one */
+    for (i = 0; res == 0 && i < 4; i++) {
+      for (j = 0; res == 0 && j < 3; j++) {
+        if (batch > 0 ? j > 0 : (i != 1 && batches[j] != 10000))
+          continue;
+        if (bench_synthetic(&c, styles[i], batch > 0 ? batch : batches[j]) != 0) {
+          fprintf(stderr, "Couldn't make the %s corpus.\n", styles[i]);
+          return 1;
+        }
+        res = bench_corpus_run(&c, filter);
+        bench_corpus_free(&c);
+      }
+    }
+    if (res == 0 && bench_wanted(filter, "date"))
+      res = bench_date(iterations);
+  }
+  if (res != 0)
+    return 1;
+
+  if ((i = bench_report(base, num_base, threshold)) > 0) {
+    fprintf(stderr, "%d stage%s more than %.0f%% slower than %s\n", i, i == 1 ? "" : "s", threshold, compare);
+    res = 1;
+  }
+  if (save != NULL && bench_save(save) != 0)
+    res = 1;
+
+  nntp_decoder_free(dec);
+  arena_free(ar);
+  free(articles);
+  free(scratch);
+  return res;
+}
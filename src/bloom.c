@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bloom.h"
+#include "hash.h"
+
+/* bits per key and probes per key for ~1% false positives */
+#define BLOOM_BITS 10
+#define BLOOM_PROBES 7
+
+bloom *
+bloom_new(capacity)
+  size_t capacity;
+{
+  bloom *b;
+  size_t bits;
+
+  b = (bloom *)malloc(sizeof(bloom));
+  if (b == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  if (capacity < 1024)
+    capacity = 1024;
+  for (bits = 8192; bits < capacity * BLOOM_BITS; bits <<= 1);
+  b->bits = (unsigned char *)calloc(bits / 8, 1);
+  if (b->bits == NULL) {
+    perror("calloc");
+    free(b);
+    return NULL;
+  }
+  b->mask = bits - 1;
+  b->count = 0;
+  b->capacity = bits / BLOOM_BITS;
+  return b;
+}
+
+void
+bloom_free(b)
+  bloom *b;
+{
+  if (b == NULL)
+    return;
+  free(b->bits);
+  free(b);
+}
+
+/* two independent-enough hashes from one: FNV-1a run through the
+ * splitmix64 finalizer, and that again; the probes are h1 + i * h2 */
+static void
+bloom_hash(key, len, h1, h2)
+  const char *key;
+  size_t len;
+  unsigned long long *h1;
+  unsigned long long *h2;
+{
+  unsigned long long h = hash_bytes(key, len);
+
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  *h1 = h ^ (h >> 31);
+  h = *h1 + 0x9e3779b97f4a7c15ULL;
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  *h2 = (h ^ (h >> 31)) | 1;
+}
+
+void
+bloom_add(b, key, len)
+  bloom *b;
+  const char *key;
+  size_t len;
+{
+  unsigned long long h1, h2, bit;
+  int i;
+
+  bloom_hash(key, len, &h1, &h2);
+  for (i = 0; i < BLOOM_PROBES; i++) {
+    bit = (h1 + i * h2) & b->mask;
+    b->bits[bit >> 3] |= 1 << (bit & 7);
+  }
+  b->count++;
+}
+
+int
+bloom_check(b, key, len)
+  bloom *b;
+  const char *key;
+  size_t len;
+{
+  unsigned long long h1, h2, bit;
+  int i;
+
+  bloom_hash(key, len, &h1, &h2);
+  for (i = 0; i < BLOOM_PROBES; i++) {
+    bit = (h1 + i * h2) & b->mask;
+    if ((b->bits[bit >> 3] & (1 << (bit & 7))) == 0)
+      return 0;
+  }
+  return 1;
+}
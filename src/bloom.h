@@ -0,0 +1,21 @@
+#ifndef _BLOOM_H
+#define _BLOOM_H
+
+#include <stddef.h>
+
+/* Bloom filter over byte strings: bloom_check() never misses a key that
+ * was added, and wrongly finds about 1% of the others while no more than
+ * capacity keys are in it */
+typedef struct {
+  unsigned char *bits;
+  size_t mask;        /* number of bits - 1, a power of two */
+  size_t count;
+  size_t capacity;
+} bloom;
+
+bloom *bloom_new(size_t);
+void bloom_free(bloom *);
+void bloom_add(bloom *, const char *, size_t);
+int bloom_check(bloom *, const char *, size_t);
+
+#endif
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "main.h"
+#include "capture.h"
+
+static FILE *
+capture_file(dir, name, mode)
+  const char *dir;
+  const char *name;
+  const char *mode;
+{
+  char path[4096];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if ((f = fopen(path, mode)) == NULL)
+    fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+  return f;
+}
+
+void
+capture_close(cap)
+  capture *cap;
+{
+  if (cap->data != NULL)
+    fclose(cap->data);
+  if (cap->index != NULL)
+    fclose(cap->index);
+  free(cap);
+}
+
+static capture *
+capture_new()
+{
+  capture *cap;
+
+  cap = (capture *)malloc(sizeof(capture));
+  if (cap == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  cap->data = cap->index = NULL;
+  cap->offset = 0;
+  return cap;
+}
+
+/* whether the index ends in the middle of a line */
+static int
+capture_unfinished(dir)
+  const char *dir;
+{
+  FILE *f;
+  int c = '\n';
+
+  if ((f = capture_file(dir, CAPTURE_INDEX, "r")) == NULL)
+    return 0;
+  if (fseeko(f, -1, SEEK_END) == 0)
+    c = fgetc(f);
+  fclose(f);
+  return c != '\n';
+}
+
+/* open the capture in dir for appending, making dir if need be; only one
+ * process may append to it at a time */
+capture *
+capture_open(dir)
+  const char *dir;
+{
+  capture *cap;
+
+  if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Couldn't make %s: %s\n", dir, strerror(errno));
+    return NULL;
+  }
+  if ((cap = capture_new()) == NULL)
+    return NULL;
+  if ((cap->index = capture_file(dir, CAPTURE_INDEX, "a")) == NULL ||
+      (cap->data = capture_file(dir, CAPTURE_DATA, "a")) == NULL) {
+    capture_close(cap);
+    return NULL;
+  }
+  if (flock(fileno(cap->index), LOCK_EX | LOCK_NB) != 0) {
+    fprintf(stderr, "Capture in %s is in use.\n", dir);
+    capture_close(cap);
+    return NULL;
+  }
+
+  /* data past the last index line is from a write that never finished;
+   * it's simply skipped, and so is an unfinished index line, once it's
+   * ended so it doesn't run into the next one */
+  if (fseeko(cap->index, 0, SEEK_END) == 0 && ftello(cap->index) > 0 && capture_unfinished(dir))
+    fputc('\n', cap->index);
+  if (fseeko(cap->data, 0, SEEK_END) != 0 || (cap->offset = ftello(cap->data)) < 0) {
+    fprintf(stderr, "Couldn't seek in %s: %s\n", dir, strerror(errno));
+    capture_close(cap);
+    return NULL;
+  }
+  return cap;
+}
+
+/* append a reply's data block; command is what was sent, without the
+ * range.  It isn't on disk until capture_sync(). */
+int
+capture_write(cap, group, low, high, backward, command, data, len)
+  capture *cap;
+  const char *group;
+  long long low;
+  long long high;
+  int backward;
+  const char *command;
+  const char *data;
+  size_t len;
+{
+  if (len > 0 && fwrite(data, 1, len, cap->data) != len) {
+    fprintf(stderr, "Couldn't write capture: %s\n", strerror(errno));
+    return 1;
+  }
+  fprintf(cap->index, "%lld %lu %s %lld %lld %s %s\n", cap->offset, (unsigned long)len, group, low, high,
+      backward ? "backward" : "forward", command);
+  cap->offset += len;
+  return 0;
+}
+
+/* flush what's been written, the data before the index lines that point
+ * into it */
+int
+capture_sync(cap)
+  capture *cap;
+{
+  if (fflush(cap->data) != 0 || fflush(cap->index) != 0 || ferror(cap->index)) {
+    fprintf(stderr, "Couldn't write capture: %s\n", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/* open the capture in dir for reading */
+capture *
+capture_read_open(dir)
+  const char *dir;
+{
+  capture *cap;
+
+  if ((cap = capture_new()) == NULL)
+    return NULL;
+  if ((cap->index = capture_file(dir, CAPTURE_INDEX, "r")) == NULL ||
+      (cap->data = capture_file(dir, CAPTURE_DATA, "r")) == NULL) {
+    capture_close(cap);
+    return NULL;
+  }
+  return cap;
+}
+
+/* read the direction in front of an index line's command at *n, moving
+ * n past it; 1 for the backfill, and 0 for forward or none at all */
+static int
+capture_direction(line, n)
+  const char *line;
+  int *n;
+{
+  char direction[16];
+  int d = 0;
+
+  if (sscanf(line + *n, "%15s %n", direction, &d) != 1 || d == 0)
+    return 0;
+  if (strcmp(direction, "forward") != 0 && strcmp(direction, "backward") != 0)
+    return 0;
+  *n += d;
+  return direction[0] == 'b';
+}
+
+/* read the next index line, skipping any that are damaged; returns 1 if
+ * there was one and 0 at the end */
+int
+capture_next(cap, rec)
+  capture *cap;
+  capture_record *rec;
+{
+  char line[1024];
+  unsigned long len;
+  size_t end;
+  int n = 0;
+
+  while (fgets(line, sizeof(line), cap->index) != NULL) {
+    end = strlen(line);
+    if (end > 0 && line[end - 1] == '\n' &&
+        sscanf(line, "%lld %lu %255s %lld %lld %n", &rec->offset, &len, rec->group, &rec->low, &rec->high, &n) == 5 &&
+        n > 0 && (rec->backward = capture_direction(line, &n), n < (int)end - 1)) {
+      rec->len = len;
+      line[end - 1] = 0;
+      snprintf(rec->command, sizeof(rec->command), "%s", line + n);
+      return 1;
+    }
+    fprintf(stderr, "Skipping bad capture index line: %.*s\n", (int)strcspn(line, "\n"), line);
+  }
+  return 0;
+}
+
+/* append a record's data block to buf */
+int
+capture_payload(cap, rec, buf)
+  capture *cap;
+  capture_record *rec;
+  fetch_buffer *buf;
+{
+  size_t size;
+  char *data;
+  ssize_t n;
+
+  if (buf->len + rec->len > buf->size) {
+    for (size = buf->size > 0 ? buf->size : CHUNK; size < buf->len + rec->len; size *= 2);
+    if ((data = (char *)realloc(buf->data, size)) == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    buf->data = data;
+    buf->size = size;
+  }
+  n = pread(fileno(cap->data), buf->data + buf->len, rec->len, (off_t)rec->offset);
+  if (n != (ssize_t)rec->len) {
+    fprintf(stderr, "Couldn't read capture at %lld: %s\n", rec->offset, n < 0 ? strerror(errno) : "short read");
+    return 1;
+  }
+  buf->len += rec->len;
+  return 0;
+}
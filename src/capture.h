@@ -0,0 +1,42 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdio.h>
+#include "fetch.h"
+
+/* a capture directory holds the replies' data blocks back to back in
+ * CAPTURE_DATA, as they came off the wire, and a line per block in
+ * CAPTURE_INDEX: "offset length group low high direction command", where
+ * direction is "forward", or "backward" for the backfill (captures from
+ * before it was kept have none, and count as forward).  Both are only
+ * ever appended to, and a block counts once its index line is written. */
+#define CAPTURE_DATA "capture.dat"
+#define CAPTURE_INDEX "capture.idx"
+
+typedef struct {
+  FILE *data;
+  FILE *index;
+  long long offset;         /* end of the data file */
+} capture;
+
+/* one block, as the index describes it */
+typedef struct {
+  long long offset;
+  size_t len;
+  char group[256];
+  long long low;
+  long long high;
+  int backward;             /* part of the backfill */
+  char command[64];         /* "XZHDR <header>", "XZVER" or "XOVER" */
+} capture_record;
+
+capture *capture_open(const char *);
+int capture_write(capture *, const char *, long long, long long, int, const char *, const char *, size_t);
+int capture_sync(capture *);
+void capture_close(capture *);
+
+capture *capture_read_open(const char *);
+int capture_next(capture *, capture_record *);
+int capture_payload(capture *, capture_record *, fetch_buffer *);
+
+#endif
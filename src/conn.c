@@ -1,125 +1,572 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include "conn.h"
 
+/* certificates to verify servers against, instead of the system's */
+static const char *nntp_ca_file = NULL;
+
+void
+nntp_conn_trust(ca_file)
+  const char *ca_file;
+{
+  nntp_ca_file = ca_file;
+}
+
 void
 nntp_conn_free(n_conn)
   nntp_conn *n_conn;
 {
-  if (n_conn->bio != NULL)
-    BIO_free_all(n_conn->bio);
+  if (n_conn->ssl != NULL)
+    SSL_free(n_conn->ssl);
 
   if (n_conn->ctx != NULL)
     SSL_CTX_free(n_conn->ctx);
 
+  if (n_conn->fd >= 0)
+    close(n_conn->fd);
+
+  if (n_conn->buf != NULL)
+    free(n_conn->buf);
+
+  if (n_conn->out != NULL)
+    free(n_conn->out);
+
   free(n_conn);
 }
 
+/* open a non-blocking socket to server, "host[:port]", and start
+ * connecting; nntp_conn_step() carries on from there */
+static int
+nntp_socket(server)
+  const char *server;
+{
+  struct addrinfo hints, *addrs, *ai;
+  char host[256];
+  const char *port = NNTP_PORT, *colon;
+  size_t len;
+  int fd = -1, res;
+
+  /* "[v6 address]:port", "host:port" or just "host" */
+  if (server[0] == '[' && (colon = strchr(server, ']')) != NULL) {
+    len = colon - server - 1;
+    server++;
+    colon = colon[1] == ':' ? colon + 1 : NULL;
+  }
+  else {
+    colon = strrchr(server, ':');
+    len = colon != NULL ? (size_t)(colon - server) : strlen(server);
+  }
+  if (colon != NULL)
+    port = colon + 1;
+  if (len >= sizeof(host)) {
+    fprintf(stderr, "Server name too long: %s\n", server);
+    return -1;
+  }
+  memcpy(host, server, len);
+  host[len] = 0;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if ((res = getaddrinfo(host, port, &hints, &addrs)) != 0) {
+    fprintf(stderr, "Couldn't connect to host: %s\n", gai_strerror(res));
+    return -1;
+  }
+  for (ai = addrs; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  if (fd < 0)
+    fprintf(stderr, "Couldn't connect to host: %s\n", strerror(errno));
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+/* start connecting to server without waiting for it; returns NULL on
+ * failure */
 nntp_conn *
-nntp_conn_new(server)
+nntp_conn_start(server)
   const char *server;
 {
   nntp_conn *n_conn;
 
   n_conn = (nntp_conn *)malloc(sizeof(nntp_conn));
+  if (n_conn == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  n_conn->fd = -1;
   n_conn->ctx = NULL;
-  n_conn->bio = NULL;
+  n_conn->ssl = NULL;
+  n_conn->out = NULL;
+  n_conn->connected = 0;
+  n_conn->want = POLLOUT;
+  n_conn->buf_pos = n_conn->buf_len = 0;
+  n_conn->buf_size = NNTP_BUFSIZE;
+  n_conn->buf = (char *)malloc(sizeof(char) * n_conn->buf_size);
+  n_conn->out_pos = n_conn->out_len = 0;
+  n_conn->out_size = NNTP_OUTSIZE;
+  n_conn->out = (char *)malloc(sizeof(char) * n_conn->out_size);
+  if (n_conn->buf == NULL || n_conn->out == NULL) {
+    nntp_conn_free(n_conn);
+    perror("malloc");
+    return NULL;
+  }
 
   n_conn->ctx = SSL_CTX_new(SSLv23_client_method());
-  if (!SSL_CTX_load_verify_locations(n_conn->ctx, NULL, "/etc/ssl/certs")) {
+  if (!SSL_CTX_load_verify_locations(n_conn->ctx, nntp_ca_file, nntp_ca_file != NULL ? NULL : "/etc/ssl/certs")) {
     nntp_conn_free(n_conn);
     fprintf(stderr, "Couldn't load certs: %s\n", ERR_reason_error_string(ERR_get_error()));
     return NULL;
   }
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  SSL_CTX_set_options(n_conn->ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
 
-  n_conn->bio = BIO_new_ssl_connect(n_conn->ctx);
-  BIO_get_ssl(n_conn->bio, &n_conn->ssl);
-  SSL_set_mode(n_conn->ssl, SSL_MODE_AUTO_RETRY);
-
-  BIO_set_conn_hostname(n_conn->bio, server);
-  if (BIO_do_connect(n_conn->bio) <= 0) {
+  if ((n_conn->fd = nntp_socket(server)) < 0) {
+    nntp_conn_free(n_conn);
+    return NULL;
+  }
+  n_conn->ssl = SSL_new(n_conn->ctx);
+  if (n_conn->ssl == NULL || !SSL_set_fd(n_conn->ssl, n_conn->fd)) {
     nntp_conn_free(n_conn);
     fprintf(stderr, "Couldn't connect to host: %s\n", ERR_reason_error_string(ERR_get_error()));
     return NULL;
   }
+  /* the send buffer may move and be written out in pieces */
+  SSL_set_mode(n_conn->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  SSL_set_connect_state(n_conn->ssl);
+  return n_conn;
+}
+
+/* set want from an SSL call's result; returns NNTP_AGAIN if it only
+ * needs the socket to be ready, -1 otherwise */
+static int
+nntp_ssl_again(n_conn, res)
+  nntp_conn *n_conn;
+  int res;
+{
+  switch (SSL_get_error(n_conn->ssl, res)) {
+  case SSL_ERROR_WANT_READ:
+    n_conn->want = POLLIN;
+    return NNTP_AGAIN;
+  case SSL_ERROR_WANT_WRITE:
+    n_conn->want = POLLOUT;
+    return NNTP_AGAIN;
+  default:
+    return -1;
+  }
+}
+
+/* carry on connecting: finish the TCP connect, then the TLS handshake,
+ * then check the certificate; returns 0 once done, NNTP_AGAIN or -1 */
+int
+nntp_conn_step(n_conn)
+  nntp_conn *n_conn;
+{
+  struct pollfd pfd;
+  socklen_t len = sizeof(int);
+  int err = 0, res;
+
+  if (!n_conn->connected) {
+    pfd.fd = n_conn->fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 0) == 0) {
+      n_conn->want = POLLOUT;
+      return NNTP_AGAIN;
+    }
+    if (getsockopt(n_conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+      fprintf(stderr, "Couldn't connect to host: %s\n", strerror(err != 0 ? err : errno));
+      return -1;
+    }
+    n_conn->connected = 1;
+  }
+
+  if ((res = SSL_connect(n_conn->ssl)) != 1) {
+    if (nntp_ssl_again(n_conn, res) == NNTP_AGAIN)
+      return NNTP_AGAIN;
+    fprintf(stderr, "Couldn't connect to host: %s\n", ERR_reason_error_string(ERR_get_error()));
+    return -1;
+  }
 
   if (SSL_get_verify_result(n_conn->ssl) != X509_V_OK) {
-    nntp_conn_free(n_conn);
     fprintf(stderr, "Couldn't verify: %s\n", ERR_reason_error_string(ERR_get_error()));
-    return NULL;
+    return -1;
   }
+  return 0;
+}
 
-  return(n_conn);
+/* wait until the socket is ready for what the last call wanted */
+static int
+nntp_wait(n_conn)
+  nntp_conn *n_conn;
+{
+  struct pollfd pfd;
+
+  pfd.fd = n_conn->fd;
+  pfd.events = n_conn->want;
+  while (poll(&pfd, 1, -1) < 0) {
+    if (errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+  }
+  return 0;
 }
 
-char *
-nntp_read(n_conn, sentinel, chomp)
+/* connect to server and wait for the handshake; returns NULL on failure */
+nntp_conn *
+nntp_conn_new(server)
+  const char *server;
+{
   nntp_conn *n_conn;
+  int res;
+
+  if ((n_conn = nntp_conn_start(server)) == NULL) {
+    return NULL;
+  }
+  while ((res = nntp_conn_step(n_conn)) == NNTP_AGAIN) {
+    if (nntp_wait(n_conn) != 0)
+      break;
+  }
+  if (res != 0) {
+    nntp_conn_free(n_conn);
+    return NULL;
+  }
+  return n_conn;
+}
+
+/* find sentinel in buf; memchr does the heavy lifting (it is vectorized
+ * in any libc worth using) and memcmp confirms the rest */
+static const char *
+nntp_scan(buf, len, sentinel, slen)
+  const char *buf;
+  size_t len;
   const char *sentinel;
+  size_t slen;
+{
+  const char *p = buf, *end = buf + len;
+
+  while ((size_t) (end - p) >= slen) {
+    p = (const char *)memchr(p, sentinel[0], (end - p) - slen + 1);
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p, sentinel, slen) == 0)
+      return p;
+    p++;
+  }
+  return NULL;
+}
+
+/* read what the server has sent into the receive buffer, without
+ * waiting; returns the number of bytes read, 0 on EOF, NNTP_AGAIN if
+ * there's nothing yet and -1 on error */
+int
+nntp_conn_fill(n_conn)
+  nntp_conn *n_conn;
+{
+  size_t avail = n_conn->buf_len - n_conn->buf_pos;
+  char *new_buf;
+  int res, err;
+
+  if (n_conn->buf_size - n_conn->buf_len < NNTP_READSIZE) {
+    if (n_conn->buf_pos > 0) {
+      /* slide unconsumed data to the front */
+      memmove(n_conn->buf, n_conn->buf + n_conn->buf_pos, avail);
+      n_conn->buf_pos = 0;
+      n_conn->buf_len = avail;
+    }
+    if (n_conn->buf_size - n_conn->buf_len < NNTP_READSIZE) {
+      new_buf = (char *)realloc((void *)n_conn->buf, n_conn->buf_size * 2);
+      if (new_buf == NULL) {
+        perror("realloc");
+        return -1;
+      }
+      n_conn->buf = new_buf;
+      n_conn->buf_size *= 2;
+    }
+  }
+
+  ERR_clear_error();
+  res = SSL_read(n_conn->ssl, n_conn->buf + n_conn->buf_len, (int) (n_conn->buf_size - n_conn->buf_len));
+  if (res <= 0) {
+    if (nntp_ssl_again(n_conn, res) == NNTP_AGAIN)
+      return NNTP_AGAIN;
+    /* a close without close_notify is still the end of the stream */
+    err = SSL_get_error(n_conn->ssl, res);
+    if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && ERR_peek_error() == 0))
+      return 0;
+    fprintf(stderr, "Couldn't read: %s\n", ERR_reason_error_string(ERR_get_error()));
+    return -1;
+  }
+  n_conn->buf_len += res;
+  return res;
+}
+
+/* read the next block from the server into the receive buffer, waiting
+ * for it; returns the number of bytes read, 0 on EOF and -1 on error */
+static int
+nntp_fill(n_conn)
+  nntp_conn *n_conn;
+{
+  int res;
+
+  while ((res = nntp_conn_fill(n_conn)) == NNTP_AGAIN) {
+    if (nntp_wait(n_conn) != 0)
+      return -1;
+  }
+  return res;
+}
+
+/* take the first len bytes off the receive buffer as a new string, minus
+ * the last chomp characters */
+static char *
+nntp_consume(n_conn, len, chomp)
+  nntp_conn *n_conn;
+  size_t len;
   int chomp;
 {
-  size_t len = 0, slen = strlen(sentinel);
-  char *head, *tail, *new_head;
-  int res, sindex = 0;
+  char *head;
 
-  head = tail = (char *)malloc(sizeof(char) * 1024);
+  head = (char *)malloc(sizeof(char) * (len - chomp + 1));
   if (head == NULL) {
     perror("malloc");
     return NULL;
   }
+  memcpy(head, n_conn->buf + n_conn->buf_pos, len - chomp);
+  head[len - chomp] = 0;
+
+  n_conn->buf_pos += len;
+  if (n_conn->buf_pos == n_conn->buf_len)
+    n_conn->buf_pos = n_conn->buf_len = 0;
+
+  return head;
+}
+
+/* consume everything up to and including sentinel from the connection,
+ * and return it as a new string minus the last chomp characters */
+char *
+nntp_read(n_conn, sentinel, chomp)
+  nntp_conn *n_conn;
+  const char *sentinel;
+  int chomp;
+{
+  size_t len, avail, scanned = 0, slen = strlen(sentinel);
+  const char *found;
+  int res;
+
   while (1) {
-    res = BIO_read(n_conn->bio, tail, 1);
+    avail = n_conn->buf_len - n_conn->buf_pos;
+    found = nntp_scan(n_conn->buf + n_conn->buf_pos + scanned, avail - scanned, sentinel, slen);
+    if (found != NULL) {
+      len = (found - (n_conn->buf + n_conn->buf_pos)) + slen;
+      break;
+    }
+
+    /* the sentinel might straddle the end of what we have */
+    if (avail >= slen)
+      scanned = avail - slen + 1;
+
+    res = nntp_fill(n_conn);
     if (res < 0) {
-      free(head);
-      fprintf(stderr, "Couldn't read: %s\n", ERR_reason_error_string(ERR_get_error()));
       return NULL;
     }
     if (res == 0) {
-      break;
+      fprintf(stderr, "Connection closed by server.\n");
+      return NULL;
     }
-    len++;
+  }
 
-    if (len % 1024 == 0) {
-      /* make sure we have enough space for string + null */
-      new_head = (char *)realloc((void *)head, sizeof(char) * (len + 1024));
-      if (new_head == NULL) {
-        free(head);
-        perror("realloc");
-        return NULL;
-      }
-      head = new_head;
-      tail = head + ((int) len) - 1;
+  return nntp_consume(n_conn, len, chomp);
+}
+
+/* take a status line off the receive buffer, if a whole one is there, as
+ * a new string without its line ending; returns 1 if it was, 0 if it
+ * wasn't and -1 on failure */
+int
+nntp_buffered_line(n_conn, line)
+  nntp_conn *n_conn;
+  char **line;
+{
+  const char *found;
+
+  found = nntp_scan(n_conn->buf + n_conn->buf_pos, n_conn->buf_len - n_conn->buf_pos, "\r\n", 2);
+  if (found == NULL)
+    return 0;
+  *line = nntp_consume(n_conn, (found - (n_conn->buf + n_conn->buf_pos)) + 2, 2);
+  return *line == NULL ? -1 : 1;
+}
+
+/* read a multiline data block up to its terminating ".\r\n"; the line
+ * ending of the last line is kept */
+char *
+nntp_read_block(n_conn)
+  nntp_conn *n_conn;
+{
+  char *head;
+  int res;
+
+  while (n_conn->buf_len - n_conn->buf_pos < 3) {
+    res = nntp_fill(n_conn);
+    if (res < 0) {
+      return NULL;
     }
+    if (res == 0) {
+      fprintf(stderr, "Connection closed by server.\n");
+      return NULL;
+    }
+  }
 
-    /* check for sentinel */
-    if (*tail == sentinel[sindex]) {
-      sindex++;
-      if (sindex == ((int) slen)) {
-        /* sentinel found */
-        break;
-      }
+  /* empty block; the terminator directly follows the status line */
+  if (memcmp(n_conn->buf + n_conn->buf_pos, ".\r\n", 3) == 0) {
+    n_conn->buf_pos += 3;
+    head = (char *)malloc(sizeof(char));
+    if (head != NULL)
+      *head = 0;
+    return head;
+  }
+
+  return nntp_read(n_conn, "\r\n.\r\n", 3);
+}
+
+/* hand out the complete lines of a multiline data block that are already
+ * in the receive buffer, without copying; returns NULL if there are
+ * none yet.  *last is set once the terminating ".\r\n" has been consumed.
+ * Every piece ends on a line boundary, and the data is only valid until
+ * the next read from n_conn. */
+const char *
+nntp_buffered_chunk(n_conn, len, last)
+  nntp_conn *n_conn;
+  size_t *len;
+  int *last;
+{
+  size_t avail = n_conn->buf_len - n_conn->buf_pos;
+  const char *head = n_conn->buf + n_conn->buf_pos, *found;
+
+  if (avail < 3)
+    return NULL;
+
+  /* we're always at the start of a line here */
+  if (memcmp(head, ".\r\n", 3) == 0) {
+    *len = 0;
+    *last = 1;
+    n_conn->buf_pos += 3;
+    return head;
+  }
+
+  found = nntp_scan(head, avail, "\r\n.\r\n", 5);
+  if (found != NULL) {
+    *len = found - head + 2;
+    *last = 1;
+    n_conn->buf_pos += *len + 3;
+    return head;
+  }
+
+  found = (const char *)memrchr(head, '\n', avail);
+  if (found != NULL && found > head && found[-1] == '\r') {
+    *len = found - head + 1;
+    *last = 0;
+    n_conn->buf_pos += *len;
+    return head;
+  }
+  return NULL;
+}
+
+/* nntp_buffered_chunk(), reading from the server until there is one */
+const char *
+nntp_read_chunk(n_conn, len, last)
+  nntp_conn *n_conn;
+  size_t *len;
+  int *last;
+{
+  const char *head;
+  int res;
+
+  while ((head = nntp_buffered_chunk(n_conn, len, last)) == NULL) {
+    res = nntp_fill(n_conn);
+    if (res < 0) {
+      return NULL;
     }
-    else {
-      sindex = 0;
+    if (res == 0) {
+      fprintf(stderr, "Connection closed by server.\n");
+      return NULL;
     }
-    tail++;
   }
-  *(tail-chomp+1) = 0;
   return head;
 }
 
+/* add cmd to the commands waiting to be written */
 int
-nntp_send(n_conn, cmd)
+nntp_queue(n_conn, cmd)
   nntp_conn *n_conn;
   const char *cmd;
 {
-  int res;
-  size_t len = strlen(cmd);
+  size_t len = strlen(cmd), size;
+  char *out;
+
 #ifdef DEBUG
   fprintf(stderr, "%s", cmd);
 #endif
-  res = BIO_write(n_conn->bio, cmd, (int) len);
-  if (res != ((int) len)) {
-    fprintf(stderr, "Couldn't write: %s\n", ERR_reason_error_string(ERR_get_error()));
-    return 1;
+  if (n_conn->out_len + len > n_conn->out_size) {
+    for (size = n_conn->out_size * 2; size < n_conn->out_len + len; size *= 2);
+    if ((out = (char *)realloc(n_conn->out, size)) == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    n_conn->out = out;
+    n_conn->out_size = size;
+  }
+  memcpy(n_conn->out + n_conn->out_len, cmd, len);
+  n_conn->out_len += len;
+  return 0;
+}
+
+/* write as much of the waiting commands as the socket takes; returns 0
+ * once they're all written, NNTP_AGAIN or -1 */
+int
+nntp_conn_flush(n_conn)
+  nntp_conn *n_conn;
+{
+  int res;
+
+  while (n_conn->out_pos < n_conn->out_len) {
+    ERR_clear_error();
+    res = SSL_write(n_conn->ssl, n_conn->out + n_conn->out_pos, (int) (n_conn->out_len - n_conn->out_pos));
+    if (res <= 0) {
+      if (nntp_ssl_again(n_conn, res) == NNTP_AGAIN)
+        return NNTP_AGAIN;
+      fprintf(stderr, "Couldn't write: %s\n", ERR_reason_error_string(ERR_get_error()));
+      return -1;
+    }
+    n_conn->out_pos += res;
   }
+  n_conn->out_pos = n_conn->out_len = 0;
   return 0;
 }
+
+/* write cmd, and anything queued before it, waiting until it's sent */
+int
+nntp_send(n_conn, cmd)
+  nntp_conn *n_conn;
+  const char *cmd;
+{
+  int res;
+
+  if (nntp_queue(n_conn, cmd) != 0)
+    return 1;
+  while ((res = nntp_conn_flush(n_conn)) == NNTP_AGAIN) {
+    if (nntp_wait(n_conn) != 0)
+      return 1;
+  }
+  return res != 0;
+}
@@ -5,15 +5,49 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+/* initial size of the receive buffer; it grows if a response won't fit */
+#define NNTP_BUFSIZE 1048576
+/* minimum amount of free space asked of each read */
+#define NNTP_READSIZE 65536
+/* initial size of the send buffer */
+#define NNTP_OUTSIZE 4096
+/* port to connect to when the server doesn't name one */
+#define NNTP_PORT "563"
+/* returned by the non-blocking calls when the socket isn't ready; want
+ * then says whether to wait for it to be readable or writable */
+#define NNTP_AGAIN -2
+
+/* a TLS connection over a non-blocking socket; the blocking calls wait
+ * for it with poll(), the others leave that to the caller */
 typedef struct {
-  BIO *bio;
+  int fd;
   SSL_CTX *ctx;
   SSL *ssl;
+  int connected;    /* TCP connect has finished */
+  int want;         /* POLLIN or POLLOUT, after NNTP_AGAIN */
+  char *buf;        /* receive buffer */
+  size_t buf_size;  /* allocated size of buf */
+  size_t buf_pos;   /* start of unconsumed data */
+  size_t buf_len;   /* end of unconsumed data */
+  char *out;        /* commands not yet written */
+  size_t out_size;
+  size_t out_pos;
+  size_t out_len;
 } nntp_conn;
 
+void nntp_conn_trust(const char *);
 nntp_conn *nntp_conn_new(const char *);
+nntp_conn *nntp_conn_start(const char *);
+int nntp_conn_step(nntp_conn *);
+int nntp_conn_fill(nntp_conn *);
+int nntp_conn_flush(nntp_conn *);
 void nntp_conn_free(nntp_conn *);
 char *nntp_read(nntp_conn*, const char*, int);
+char *nntp_read_block(nntp_conn *);
+const char *nntp_read_chunk(nntp_conn *, size_t *, int *);
+int nntp_buffered_line(nntp_conn *, char **);
+const char *nntp_buffered_chunk(nntp_conn *, size_t *, int *);
+int nntp_queue(nntp_conn *, const char *);
 int nntp_send(nntp_conn *, const char *);
 
 #endif
@@ -0,0 +1,1544 @@
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "main.h"
+#include "crawl.h"
+#include "session.h"
+#include "fetch.h"
+#include "stats.h"
+
+/* a crawler with up to connections sessions, the first of which may
+ * already be logged in (n_conn); it takes over n_conn */
+crawl *
+crawl_new(server, user, password, n_conn, connections, pipeline, overview, width_min, width_max)
+  const char *server;
+  const char *user;
+  const char *password;
+  nntp_conn *n_conn;
+  int connections;
+  int pipeline;
+  int overview;
+  long long width_min;
+  long long width_max;
+{
+  crawl *c;
+  int i;
+
+  c = (crawl *)malloc(sizeof(crawl));
+  if (c == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  c->sessions = (crawl_worker *)malloc(sizeof(crawl_worker) * connections);
+  c->decode_threads = (pthread_t *)malloc(sizeof(pthread_t) * connections);
+  if (c->sessions == NULL || c->decode_threads == NULL) {
+    perror("malloc");
+    free(c->sessions);
+    free(c->decode_threads);
+    free(c);
+    return NULL;
+  }
+  if ((c->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+    perror("eventfd");
+    free(c->sessions);
+    free(c->decode_threads);
+    free(c);
+    return NULL;
+  }
+  for (i = 0; i < connections; i++) {
+    c->sessions[i].c = c;
+    c->sessions[i].n_conn = i == 0 ? n_conn : NULL;
+    c->sessions[i].state = crawl_finished;
+    c->sessions[i].compressed = 1;
+    c->sessions[i].probed = 0;
+    c->sessions[i].batch = NULL;
+  }
+  c->connections = connections;
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  c->next = c->high = c->committed = 0;
+  c->width_min = width_min;
+  c->width_max = width_max;
+  c->width = LIMIT < width_min ? width_min : LIMIT > width_max ? width_max : LIMIT;
+  c->outstanding = c->max_outstanding = 0;
+  c->fetched = c->done = c->spare = NULL;
+  c->retry = NULL;
+  c->retries = c->retry_size = 0;
+  c->back_next = c->back_committed = 0;
+  c->back_low = 1;
+  c->back_outstanding = 0;
+  c->back_done = NULL;
+  c->fetched_tail = &c->fetched;
+  c->workers = c->decoders = 0;
+  c->failed = 0;
+  c->group = NULL;
+  c->group_id = 0;
+  c->server = server;
+  c->user = user;
+  c->password = password;
+  c->pipeline = pipeline > MAX_PIPELINE ? MAX_PIPELINE : pipeline;
+  c->overview = overview;
+  c->capture = NULL;
+  c->repairing = 0;
+  return c;
+}
+
+static crawl_batch *
+crawl_batch_new(size)
+  int size;
+{
+  crawl_batch *batch;
+
+  batch = (crawl_batch *)malloc(sizeof(crawl_batch));
+  if (batch == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  batch->size = size;
+  batch->raw.data = NULL;
+  batch->raw.len = batch->raw.size = 0;
+  batch->articles = (article *)malloc(sizeof(article) * size);
+  batch->arena = arena_new(ARENA_BLOCK);
+  if (batch->articles == NULL || batch->arena == NULL) {
+    if (batch->arena != NULL)
+      arena_free(batch->arena);
+    free(batch->articles);
+    free(batch);
+    perror("malloc");
+    return NULL;
+  }
+  return batch;
+}
+
+static void
+crawl_batch_free(batch)
+  crawl_batch *batch;
+{
+  arena_free(batch->arena);
+  free(batch->raw.data);
+  free(batch->articles);
+  free(batch);
+}
+
+/* take a spare batch, or make a new one, for articles low..high */
+static crawl_batch *
+crawl_batch_get(c, low, high)
+  crawl *c;
+  long long low;
+  long long high;
+{
+  crawl_batch *batch;
+  article *articles;
+  int size = (int)(high - low + 1);
+
+  pthread_mutex_lock(&c->lock);
+  if ((batch = c->spare) != NULL)
+    c->spare = batch->next;
+  pthread_mutex_unlock(&c->lock);
+
+  if (batch == NULL && (batch = crawl_batch_new(size)) == NULL) {
+    return NULL;
+  }
+  if (batch->size < size) {
+    /* ranges have grown since this one was made */
+    if ((articles = (article *)malloc(sizeof(article) * size)) == NULL) {
+      perror("malloc");
+      crawl_batch_free(batch);
+      return NULL;
+    }
+    free(batch->articles);
+    batch->articles = articles;
+    batch->size = size;
+  }
+
+  /* zeroed, so that fields a reply didn't cover are simply empty */
+  memset(batch->articles, 0, sizeof(article) * (high - low + 1));
+  arena_reset(batch->arena);
+  batch->low = low;
+  batch->high = high;
+  batch->raw.len = 0;
+  batch->compressed = 0;
+  batch->backward = 0;
+  batch->unavailable = 0;
+  batch->undecoded = 0;
+  batch->count = 0;
+  batch->fetched = 0;
+  batch->next = NULL;
+  return batch;
+}
+
+/* hand a batch back for reuse; called with the lock held */
+static void
+crawl_batch_put(c, batch)
+  crawl *c;
+  crawl_batch *batch;
+{
+  batch->next = c->spare;
+  c->spare = batch;
+}
+
+/* log out of every session and free everything */
+void
+crawl_free(c)
+  crawl *c;
+{
+  crawl_batch *batch;
+  int i;
+
+  for (i = 0; i < c->connections; i++) {
+    if (c->sessions[i].n_conn != NULL)
+      nntp_shutdown(c->sessions[i].n_conn, NULL);
+  }
+  for (i = 0; i < c->retries; i++) {
+    if (c->retry[i].batch != NULL)
+      crawl_batch_free(c->retry[i].batch);
+  }
+  free(c->sessions);
+  free(c->decode_threads);
+  free(c->retry);
+  close(c->wake);
+
+  while ((batch = c->fetched) != NULL) {
+    c->fetched = batch->next;
+    crawl_batch_free(batch);
+  }
+  while ((batch = c->done) != NULL) {
+    c->done = batch->next;
+    crawl_batch_free(batch);
+  }
+  while ((batch = c->back_done) != NULL) {
+    c->back_done = batch->next;
+    crawl_batch_free(batch);
+  }
+  while ((batch = c->spare) != NULL) {
+    c->spare = batch->next;
+    crawl_batch_free(batch);
+  }
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->cond);
+  free(c);
+}
+
+/* read a group's marks over the first session, which is idle between
+ * runs; if the server has dropped it, log in again once */
+int
+crawl_poll(c, group, low, high)
+  crawl *c;
+  const char *group;
+  long long *low;
+  long long *high;
+{
+  crawl_worker *w = &c->sessions[0];
+  nntp_group *n_group = NULL;
+  int tries;
+
+  for (tries = 0; tries < 2 && n_group == NULL; tries++) {
+    if (w->n_conn == NULL) {
+      if ((w->n_conn = nntp_login(c->server, c->user, c->password)) == NULL)
+        return 1;
+      w->compressed = 1;
+      w->probed = 0;
+      tries++;
+    }
+    if ((n_group = nntp_select_group(w->n_conn, group)) == NULL && tries == 0) {
+      nntp_conn_free(w->n_conn);
+      w->n_conn = NULL;
+    }
+  }
+  if (n_group == NULL)
+    return 1;
+  *low = n_group->low;
+  *high = n_group->high;
+  nntp_group_free(n_group);
+  return 0;
+}
+
+/* size the next ranges from how this one went: aim for BATCH_LATENCY
+ * seconds of replies and BATCH_BYTES of headers, moving by at most a
+ * factor of two at a time, and don't shrink while the writer is the slow
+ * part, since smaller ranges only mean more commits for it; called with
+ * the lock held */
+static void
+crawl_adapt(c, batch, written)
+  crawl *c;
+  crawl_batch *batch;
+  double written;
+{
+  double width = (double)(batch->high - batch->low + 1), target, bytes;
+
+  target = batch->fetched > 0 ? width * BATCH_LATENCY / batch->fetched : width * 2;
+  bytes = (double)arena_used(batch->arena);
+  if (bytes > 0 && target > width * BATCH_BYTES / bytes)
+    target = width * BATCH_BYTES / bytes;
+  if (target > width * 2)
+    target = width * 2;
+  if (target < width / 2)
+    target = width / 2;
+  if (target < c->width && written > batch->fetched)
+    target = c->width;
+
+  /* other sessions' ranges are still in flight; move part of the way */
+  c->width = (long long)((3 * c->width + target) / 4);
+  if (c->width < c->width_min)
+    c->width = c->width_min;
+  if (c->width > c->width_max)
+    c->width = c->width_max;
+}
+
+/* hand out the next range of articles; returns 0 if it did, 1 if there's
+ * no room for another until the writer catches up, and -1 once there's
+ * nothing left to hand out.  Ranges handed back by a failed session come
+ * first, since the writer is waiting on them.  Then new articles, but the
+ * backfill gets every other range while both have some left.  Sessions
+ * wait rather than finish while ranges are still being read, in case one
+ * is handed back. */
+static int
+crawl_claim(c, r)
+  crawl *c;
+  crawl_range *r;
+{
+  int res = 0, forward, back;
+
+  pthread_mutex_lock(&c->lock);
+  forward = c->next <= c->high;
+  back = c->back_next >= c->back_low;
+  if (c->failed) {
+    res = -1;
+  }
+  else if (c->retries > 0) {
+    *r = c->retry[--c->retries];
+  }
+  else if (!forward && !back) {
+    res = c->outstanding > 0 ? 1 : -1;
+  }
+  else if (c->outstanding >= c->max_outstanding) {
+    res = 1;
+  }
+  else if (back && (!forward || 2 * c->back_outstanding < c->outstanding)) {
+    r->high = c->back_next;
+    r->low = c->back_next - c->width + 1;
+    if (r->low < c->back_low)
+      r->low = c->back_low;
+    c->back_next = r->low - 1;
+    c->outstanding++;
+    c->back_outstanding++;
+    r->backward = 1;
+    r->failures = 0;
+    r->batch = NULL;
+    r->done = 0;
+  }
+  else {
+    r->low = c->next;
+    r->high = c->next + c->width - 1;
+    if (r->high > c->high)
+      r->high = c->high;
+    c->next = r->high + 1;
+    c->outstanding++;
+    r->backward = 0;
+    r->failures = 0;
+    r->batch = NULL;
+    r->done = 0;
+  }
+  pthread_mutex_unlock(&c->lock);
+  return res;
+}
+
+/* get the event loop to look at its sessions again */
+static void
+crawl_wake(c)
+  crawl *c;
+{
+  uint64_t one = 1;
+
+  if (write(c->wake, &one, sizeof(one)) < 0)
+    perror("write");
+}
+
+/* queue a batch that has been read for the decode threads */
+static void
+crawl_fetched(c, batch)
+  crawl *c;
+  crawl_batch *batch;
+{
+  pthread_mutex_lock(&c->lock);
+  batch->next = NULL;
+  *c->fetched_tail = batch;
+  c->fetched_tail = &batch->next;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* queue a decoded batch for the writer, keeping the queue sorted in the
+ * order it writes them; called with the lock held */
+static void
+crawl_finish(c, batch)
+  crawl *c;
+  crawl_batch *batch;
+{
+  crawl_batch **cur;
+
+  if (batch->backward)
+    for (cur = &c->back_done; *cur != NULL && (*cur)->high > batch->high; cur = &(*cur)->next);
+  else
+    for (cur = &c->done; *cur != NULL && (*cur)->low < batch->low; cur = &(*cur)->next);
+  batch->next = *cur;
+  *cur = batch;
+}
+
+/* the queue holding the batch to write next, if it has been decoded;
+ * called with the lock held */
+static crawl_batch **
+crawl_writable(c)
+  crawl *c;
+{
+  if (c->done != NULL && c->done->low == c->committed)
+    return &c->done;
+  if (c->back_done != NULL && c->back_done->high == c->back_committed - 1)
+    return &c->back_done;
+  return NULL;
+}
+
+static int
+crawl_failed(c)
+  crawl *c;
+{
+  int failed;
+
+  pthread_mutex_lock(&c->lock);
+  failed = c->failed;
+  pthread_mutex_unlock(&c->lock);
+  return failed;
+}
+
+/* whether there's nothing left for a session to read, now or later */
+static int
+crawl_idle(c)
+  crawl *c;
+{
+  int idle;
+
+  pthread_mutex_lock(&c->lock);
+  idle = c->failed || (c->retries == 0 && c->outstanding == 0 && c->next > c->high && c->back_next < c->back_low);
+  pthread_mutex_unlock(&c->lock);
+  return idle;
+}
+
+static void
+crawl_worker_exit(c, failed)
+  crawl *c;
+  int failed;
+{
+  pthread_mutex_lock(&c->lock);
+  if (failed)
+    c->failed = 1;
+  c->workers--;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+}
+
+/* parse a batch's replies into its articles.  Replies that don't decode
+ * leave the batch empty and marked, so that the writer keeps the range
+ * as a gap rather than passing over it */
+static void
+crawl_decode(c, dec, batch)
+  crawl *c;
+  nntp_decoder *dec;
+  crawl_batch *batch;
+{
+  int j, count = 0;
+  size_t from;
+
+  if (c->overview) {
+    count = decode_overview(dec, batch->raw.data, batch->raw.len, batch->articles, batch->arena,
+        batch->compressed, batch->low, batch->high, c->group_id);
+  }
+  for (j = 0, from = 0; !c->overview && headers[j] != NULL && count >= 0; from = batch->ends[j++]) {
+    count = decode_headers(dec, batch->raw.data + from, batch->ends[j] - from, batch->articles, batch->arena,
+        headers[j], batch->low, batch->high, c->group_id, j);
+  }
+  if (count < 0) {
+    fprintf(stderr, "Couldn't decode %lld-%lld of %s.\n", batch->low, batch->high, c->group);
+    batch->undecoded = 1;
+    count = 0;
+  }
+  batch->count = count;
+}
+
+/* one decode thread: take batches as they're read, parse them, and hand
+ * them to the writer */
+static void *
+crawl_decoder_main(arg)
+  void *arg;
+{
+  crawl *c = (crawl *)arg;
+  crawl_batch *batch;
+  nntp_decoder *dec;
+  int res = 0;
+
+  if ((dec = nntp_decoder_new()) == NULL)
+    res = 1;
+
+  pthread_mutex_lock(&c->lock);
+  while (res == 0) {
+    while (!c->failed && c->fetched == NULL && c->workers > 0)
+      pthread_cond_wait(&c->cond, &c->lock);
+    if (c->failed || c->fetched == NULL)
+      break;
+
+    batch = c->fetched;
+    if ((c->fetched = batch->next) == NULL)
+      c->fetched_tail = &c->fetched;
+    pthread_mutex_unlock(&c->lock);
+    crawl_decode(c, dec, batch);
+    pthread_mutex_lock(&c->lock);
+
+    crawl_finish(c, batch);
+    pthread_cond_broadcast(&c->cond);
+  }
+  if (res != 0)
+    c->failed = 1;
+  c->decoders--;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+  if (res != 0)
+    crawl_wake(c);
+
+  if (dec != NULL)
+    nntp_decoder_free(dec);
+  return NULL;
+}
+
+/* queue all the commands for a range, but those whose replies were read
+ * before it was handed back */
+static int
+crawl_request(w, r)
+  crawl_worker *w;
+  crawl_range *r;
+{
+  r->requested = 1;
+  if (w->c->overview)
+    return request_overview(w->n_conn, w->compressed, r->low, r->high);
+  return request_headers(w->n_conn, r->done, NUM_HEADERS - r->done, r->low, r->high);
+}
+
+/* queue the command for the oldest range's next reply, when it wasn't
+ * requested ahead */
+static int
+crawl_ask(w, r)
+  crawl_worker *w;
+  crawl_range *r;
+{
+  if (w->c->overview)
+    return crawl_request(w, r);
+  return request_headers(w->n_conn, w->reply, 1, r->low, r->high);
+}
+
+/* set a session going on the current group, logging in first if it
+ * isn't connected */
+static int
+crawl_session_start(w)
+  crawl_worker *w;
+{
+  crawl *c = w->c;
+  char cmd[1024];
+
+  w->head = w->pending = 0;
+  w->batch = NULL;
+  w->in_block = 0;
+  w->refused = 0;
+  w->events = 0;
+  w->started = stats_clock();
+  if (w->n_conn != NULL) {
+    snprintf(cmd, sizeof(cmd), "GROUP %s\r\n", c->group);
+    w->state = crawl_selecting;
+    return nntp_queue(w->n_conn, cmd);
+  }
+  w->compressed = 1;
+  w->probed = 0;
+  w->state = crawl_connecting;
+  return (w->n_conn = nntp_conn_start(c->server)) == NULL;
+}
+
+/* what to make of a status line that isn't the one we wanted: -1 if
+ * the server has dropped the session, so that connecting again might
+ * help, -2 if it won't, and 0 if only the command failed for that range.
+ * A command the server doesn't know won't work for any range. */
+static int
+crawl_refused(n_res)
+  nntp_response *n_res;
+{
+  switch (n_res->status) {
+  case NNTP_SERVICE_UNAVAILABLE:
+  case NNTP_AUTH_REQUIRED:
+    fprintf(stderr, "Server dropped the session: %s %s\n", n_res->code, n_res->msg);
+    return -1;
+  case NNTP_AUTH_REJECTED:
+  case NNTP_ACCESS_DENIED:
+  case NNTP_NO_SUCH_GROUP:
+    fprintf(stderr, "Server refused: %s %s\n", n_res->code, n_res->msg);
+    return -2;
+  case NNTP_UNKNOWN_COMMAND:
+  case NNTP_SYNTAX_ERROR:
+    fprintf(stderr, "Server doesn't support the command: %s %s\n", n_res->code, n_res->msg);
+    return -2;
+  }
+  return 0;
+}
+
+/* act on a status line while logging in and selecting the group */
+static int
+crawl_session_login(w, n_res)
+  crawl_worker *w;
+  nntp_response *n_res;
+{
+  crawl *c = w->c;
+  char cmd[1024];
+  double now = stats_clock();
+
+  switch (w->state) {
+  case crawl_greeting:
+    if (n_res->status != NNTP_OK) {
+      fprintf(stderr, "Status wasn't OK.\n");
+      return crawl_refused(n_res) == -2 ? -2 : -1;
+    }
+    snprintf(cmd, sizeof(cmd), "AUTHINFO USER %s\r\n", c->user);
+    w->state = crawl_user;
+    return nntp_queue(w->n_conn, cmd);
+  case crawl_user:
+    if (n_res->status == NNTP_PASS_REQUIRED) {
+      snprintf(cmd, sizeof(cmd), "AUTHINFO PASS %s\r\n", c->password);
+      w->state = crawl_pass;
+      return nntp_queue(w->n_conn, cmd);
+    }
+    /* FALLTHROUGH */
+  case crawl_pass:
+    if (n_res->status != NNTP_AUTH_OK) {
+      fprintf(stderr, "Authentication was unsuccessful.\n");
+      return n_res->status == NNTP_SERVICE_UNAVAILABLE ? -1 : -2;
+    }
+    stats_time(stat_auth, now - w->started);
+    w->started = now;
+    snprintf(cmd, sizeof(cmd), "GROUP %s\r\n", c->group);
+    w->state = crawl_selecting;
+    return nntp_queue(w->n_conn, cmd);
+  default:
+    stats_time(stat_group, now - w->started);
+    if (n_res->status != NNTP_GROUP_OK) {
+      fprintf(stderr, "Group command wasn't successful.\n");
+      return crawl_refused(n_res) == -2 ? -2 : -1;
+    }
+    w->state = crawl_fetching;
+    return 0;
+  }
+}
+
+/* claim ranges until the pipeline is full, requesting them ahead once we
+ * know which overview command works, and start reading the oldest one;
+ * returns 1 once there's nothing left for the session to do */
+static int
+crawl_session_pump(w)
+  crawl_worker *w;
+{
+  crawl *c = w->c;
+  crawl_range *r;
+  int i, ahead, depth, res = 0;
+
+  ahead = c->pipeline > 0 && (!c->overview || w->probed);
+  depth = ahead ? c->pipeline : 1;
+  for (i = 0; ahead && i < w->pending; i++) {
+    r = &w->ranges[(w->head + i) % MAX_PIPELINE];
+    if (!r->requested && crawl_request(w, r) != 0)
+      return -1;
+  }
+
+  while (w->pending < depth && (res = crawl_claim(c, &w->ranges[(w->head + w->pending) % MAX_PIPELINE])) == 0) {
+    r = &w->ranges[(w->head + w->pending) % MAX_PIPELINE];
+    r->requested = 0;
+    w->pending++;
+    if (ahead && crawl_request(w, r) != 0)
+      return -1;
+  }
+  /* with nothing claimed, wait for the writer to make room */
+  if (w->pending == 0)
+    return res < 0;
+  if (w->batch != NULL)
+    return 0;
+
+  /* a range handed back part way carries on from where it stopped */
+  r = &w->ranges[w->head];
+  if (r->batch != NULL) {
+    w->batch = r->batch;
+    r->batch = NULL;
+  }
+  else if ((w->batch = crawl_batch_get(c, r->low, r->high)) == NULL) {
+    return -1;
+  }
+  w->batch->backward = r->backward;
+  w->reply = r->done;
+  w->fetch_start = w->started = stats_clock();
+  return r->requested ? 0 : crawl_ask(w, r);
+}
+
+/* make room for n more ranges to be handed back; called with the lock
+ * held */
+static int
+crawl_retry_reserve(c, n)
+  crawl *c;
+  int n;
+{
+  crawl_range *retry;
+  int size;
+
+  if (c->retries + n <= c->retry_size)
+    return 0;
+  size = (c->retries + n) * 2;
+  if ((retry = (crawl_range *)realloc(c->retry, sizeof(crawl_range) * size)) == NULL) {
+    perror("realloc");
+    c->failed = 1;
+    return -1;
+  }
+  c->retry = retry;
+  c->retry_size = size;
+  return 0;
+}
+
+/* hand a session's ranges back, as they were, for any session to read
+ * again; losing the connection says nothing about the ranges.  The
+ * whole replies already read for the oldest go back with it, so that
+ * the next session only asks for the rest. */
+static int
+crawl_requeue(w)
+  crawl_worker *w;
+{
+  crawl *c = w->c;
+  crawl_range *r = &w->ranges[w->head];
+  int i, res;
+
+  pthread_mutex_lock(&c->lock);
+  /* unless the server had already failed it */
+  if (w->refused)
+    r->failures++;
+  if (w->batch != NULL && w->pending > 0 && !c->overview && !w->refused && w->reply > 0) {
+    w->batch->raw.len = w->batch->ends[w->reply - 1];
+    r->batch = w->batch;
+    r->done = w->reply;
+  }
+  else if (w->batch != NULL) {
+    crawl_batch_put(c, w->batch);
+  }
+  w->batch = NULL;
+  /* newest first, so that the oldest are claimed first */
+  if ((res = crawl_retry_reserve(c, w->pending)) == 0) {
+    for (i = w->pending - 1; i >= 0; i--)
+      c->retry[c->retries++] = w->ranges[(w->head + i) % MAX_PIPELINE];
+  }
+  w->head = w->pending = 0;
+  pthread_mutex_unlock(&c->lock);
+
+  /* other sessions may be waiting for something to claim */
+  crawl_wake(c);
+  return res;
+}
+
+/* the server has answered every command for the oldest range, but failed
+ * at least one: hand that range back for any session to read again, and
+ * keep the session reading the ones behind it.  A range that keeps
+ * failing is split in two, and a single article that does is given up
+ * on: an empty batch stands in for it, so that the writer keeps it as a
+ * gap and carries on. */
+static int
+crawl_refuse(w)
+  crawl_worker *w;
+{
+  crawl *c = w->c;
+  crawl_range r = w->ranges[w->head], half;
+  crawl_batch *batch = w->batch;
+  int lost = 0, res;
+
+  w->batch = NULL;
+  w->head = (w->head + 1) % MAX_PIPELINE;
+  w->pending--;
+  w->refused = 0;
+
+  r.batch = NULL;
+  r.done = 0;
+  pthread_mutex_lock(&c->lock);
+  crawl_batch_put(c, batch);
+  if ((res = crawl_retry_reserve(c, 2)) != 0) {
+    pthread_mutex_unlock(&c->lock);
+    return res;
+  }
+  if (++r.failures < RETRY_RANGE) {
+    c->retry[c->retries++] = r;
+  }
+  else if (r.low < r.high) {
+    fprintf(stderr, "Splitting %lld-%lld of %s after %d failures.\n", r.low, r.high, c->group, r.failures);
+    r.failures = 0;
+    half = r;
+    half.high = r.low + (r.high - r.low) / 2;
+    r.low = half.high + 1;
+    /* the half the writer needs first goes on last */
+    c->retry[c->retries++] = r.backward ? half : r;
+    c->retry[c->retries++] = r.backward ? r : half;
+    c->outstanding++;
+    if (r.backward)
+      c->back_outstanding++;
+  }
+  else {
+    fprintf(stderr, "Giving up on article %lld of %s after %d failures.\n", r.low, c->group, r.failures);
+    lost = 1;
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  if (lost) {
+    if ((batch = crawl_batch_get(c, r.low, r.high)) == NULL) {
+      res = -1;
+    }
+    else {
+      batch->backward = r.backward;
+      batch->unavailable = 1;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (batch == NULL)
+      c->failed = 1;
+    else
+      crawl_finish(c, batch);
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+  }
+  crawl_wake(c);
+  return res;
+}
+
+/* take a piece of the data block being read; once the oldest range has
+ * all its replies, queue it for decoding and move on */
+static int
+crawl_session_data(w, data, len, last)
+  crawl_worker *w;
+  const char *data;
+  size_t len;
+  int last;
+{
+  crawl *c = w->c;
+  crawl_range *r = &w->ranges[w->head];
+  double now;
+
+  if (fetch_append(&w->batch->raw, data, len) != 0)
+    return -1;
+  stats_add(stat_bytes_wire, (long long)len);
+  if (!last)
+    return 0;
+
+  now = stats_clock();
+  stats_time(stat_transfer, now - w->started);
+  w->started = now;
+  w->in_block = 0;
+  w->tries = 0;
+  if (!c->overview) {
+    w->batch->ends[w->reply++] = w->batch->raw.len;
+    /* once the range has failed, only replies already on their way are
+     * read */
+    if (w->reply < NUM_HEADERS && r->requested)
+      return 0;
+    if (w->reply < NUM_HEADERS && !w->refused)
+      return crawl_ask(w, r);
+  }
+  if (w->refused)
+    return crawl_refuse(w) != 0 ? -2 : crawl_session_pump(w);
+
+  w->batch->fetched = now - w->fetch_start;
+  crawl_fetched(c, w->batch);
+  w->batch = NULL;
+  w->head = (w->head + 1) % MAX_PIPELINE;
+  w->pending--;
+  return crawl_session_pump(w);
+}
+
+/* act on the status line of the oldest range's next reply */
+static int
+crawl_session_reply(w, n_res)
+  crawl_worker *w;
+  nntp_response *n_res;
+{
+  crawl *c = w->c;
+  crawl_range *r = &w->ranges[w->head];
+  double now = stats_clock();
+  int res;
+
+  stats_time(stat_reply, now - w->started);
+  w->started = now;
+  if (n_res->status == NNTP_NO_ARTICLES) {
+    /* nothing in the range; there's no data block to read */
+    w->probed = 1;
+    return crawl_session_data(w, "", 0, 1);
+  }
+  res = c->overview ? accept_overview(n_res) : accept_headers(n_res);
+  if (res == -2 && w->compressed && !w->probed) {
+    /* no XZVER here; fall back to plain XOVER */
+    w->compressed = 0;
+    return crawl_request(w, r);
+  }
+  w->probed = 1;
+  if (res < 0) {
+    if ((res = crawl_refused(n_res)) != 0)
+      return res;
+    if (!w->refused)
+      fprintf(stderr, "Server failed %lld-%lld of %s: %s %s\n", r->low, r->high, c->group, n_res->code, n_res->msg);
+    /* there's no data block; carry on with the range's other replies */
+    w->refused = 1;
+    return crawl_session_data(w, "", 0, 1);
+  }
+  w->batch->compressed = w->compressed;
+  w->in_block = 1;
+  return 0;
+}
+
+/* act on everything the server has sent so far; returns 0 to wait for
+ * more, 1 once the session is done and -1 on failure */
+static int
+crawl_session_process(w)
+  crawl_worker *w;
+{
+  nntp_response *n_res;
+  const char *data;
+  char *line;
+  size_t len;
+  int res = 0, last;
+
+  while (res == 0) {
+    if (w->state == crawl_fetching && w->batch == NULL) {
+      if ((res = crawl_session_pump(w)) != 0 || w->batch == NULL)
+        break;
+    }
+    if (w->in_block) {
+      if ((data = nntp_buffered_chunk(w->n_conn, &len, &last)) == NULL)
+        break;
+      res = crawl_session_data(w, data, len, last);
+      continue;
+    }
+
+    if ((res = nntp_buffered_line(w->n_conn, &line)) <= 0)
+      break;
+    if ((n_res = nntp_response_parse(line)) == NULL)
+      return -1;
+    if (w->state == crawl_fetching)
+      res = crawl_session_reply(w, n_res);
+    else
+      res = crawl_session_login(w, n_res);
+    nntp_response_free(n_res);
+  }
+  return res;
+}
+
+/* move a session on as far as its socket allows without waiting */
+static int
+crawl_session_run(w)
+  crawl_worker *w;
+{
+  nntp_conn *n_conn = w->n_conn;
+  double now;
+  int res;
+
+  if (w->state == crawl_connecting) {
+    if ((res = nntp_conn_step(n_conn)) != 0)
+      return res == NNTP_AGAIN ? 0 : -1;
+    now = stats_clock();
+    stats_time(stat_connect, now - w->started);
+    w->started = now;
+    w->state = crawl_greeting;
+  }
+
+  while (1) {
+    if ((res = crawl_session_process(w)) != 0)
+      return res;
+    if (nntp_conn_flush(n_conn) == -1)
+      return -1;
+    res = nntp_conn_fill(n_conn);
+    if (res == NNTP_AGAIN)
+      return 0;
+    if (res == 0) {
+      fprintf(stderr, "Connection closed by server.\n");
+      return -1;
+    }
+    if (res < 0)
+      return -1;
+  }
+}
+
+/* what to wait for on a session's socket */
+static int
+crawl_session_events(w)
+  crawl_worker *w;
+{
+  nntp_conn *n_conn = w->n_conn;
+
+  if (w->state == crawl_connecting)
+    return n_conn->want == POLLIN ? EPOLLIN : EPOLLOUT;
+  if (n_conn->out_pos < n_conn->out_len || n_conn->want == POLLOUT)
+    return EPOLLIN | EPOLLOUT;
+  return EPOLLIN;
+}
+
+/* after a failure that connecting again might fix: drop the session's
+ * connection, hand its ranges back, and wait a while before logging in
+ * again, twice as long after each failure in a row.  Returns 1 if it has
+ * failed too often and is done. */
+static int
+crawl_session_retry(w, epfd)
+  crawl_worker *w;
+  int epfd;
+{
+  crawl *c = w->c;
+  int delay;
+
+  if (w->events != 0)
+    epoll_ctl(epfd, EPOLL_CTL_DEL, w->n_conn->fd, NULL);
+  w->events = 0;
+  if (w->n_conn != NULL)
+    nntp_conn_free(w->n_conn);
+  w->n_conn = NULL;
+  if (crawl_requeue(w) != 0 || ++w->tries > RETRY_SESSION) {
+    if (w->tries > RETRY_SESSION)
+      fprintf(stderr, "Giving up on a session after %d failures in a row.\n", RETRY_SESSION);
+    w->state = crawl_finished;
+    crawl_worker_exit(c, 0);
+    return 1;
+  }
+
+  delay = w->tries > 7 ? RETRY_MAX : RETRY_MIN << (w->tries - 1);
+  if (delay > RETRY_MAX)
+    delay = RETRY_MAX;
+  fprintf(stderr, "Connecting again in %d seconds.\n", delay);
+  w->retry_at = stats_clock() + delay;
+  w->state = crawl_waiting;
+  return 0;
+}
+
+/* take a session out of the loop; res is what its last step returned.
+ * If it failed, whatever it had claimed goes back for the other sessions
+ * to read. */
+static void
+crawl_session_end(w, epfd, res)
+  crawl_worker *w;
+  int epfd;
+  int res;
+{
+  crawl *c = w->c;
+  crawl_range *r;
+  int i;
+
+  if (w->events != 0)
+    epoll_ctl(epfd, EPOLL_CTL_DEL, w->n_conn->fd, NULL);
+  if (res < 0)
+    fprintf(stderr, "Couldn't %s session; continuing without it.\n", w->state == crawl_fetching ? "fetch with" : "start");
+  if (res < 0 && !crawl_failed(c))
+    crawl_requeue(w);
+
+  /* a session left with replies in flight is no use for the next group */
+  if (res < 0 || w->state != crawl_fetching || w->pending != 0 || w->batch != NULL) {
+    if (w->n_conn != NULL)
+      nntp_conn_free(w->n_conn);
+    w->n_conn = NULL;
+  }
+  pthread_mutex_lock(&c->lock);
+  if (w->batch != NULL)
+    crawl_batch_put(c, w->batch);
+  w->batch = NULL;
+  /* and ranges dropped with the run may have been handed back part way */
+  for (i = 0; i < w->pending; i++) {
+    r = &w->ranges[(w->head + i) % MAX_PIPELINE];
+    if (r->batch != NULL)
+      crawl_batch_put(c, r->batch);
+    r->batch = NULL;
+  }
+  pthread_mutex_unlock(&c->lock);
+  w->state = crawl_finished;
+  crawl_worker_exit(c, 0);
+}
+
+/* run a session and watch its socket for what it needs next; returns 1
+ * if the session is done */
+static int
+crawl_session_step(w, epfd)
+  crawl_worker *w;
+  int epfd;
+{
+  struct epoll_event ev;
+  int res;
+
+  if (w->state == crawl_finished)
+    return 0;
+  if (w->state == crawl_waiting && crawl_idle(w->c)) {
+    crawl_session_end(w, epfd, 1);
+    return 1;
+  }
+  if (w->state == crawl_waiting && stats_clock() < w->retry_at)
+    return 0;
+  if (w->state == crawl_waiting && crawl_session_start(w) != 0)
+    res = -1;
+  else if ((res = crawl_session_run(w)) == 0) {
+    ev.events = crawl_session_events(w);
+    ev.data.ptr = w;
+    if (ev.events == w->events)
+      return 0;
+    if (epoll_ctl(epfd, w->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, w->n_conn->fd, &ev) == 0) {
+      w->events = ev.events;
+      return 0;
+    }
+    perror("epoll_ctl");
+    res = -1;
+  }
+  if (res == -1 && !crawl_failed(w->c))
+    return crawl_session_retry(w, epfd);
+  crawl_session_end(w, epfd, res);
+  return 1;
+}
+
+/* milliseconds until the next waiting session is due to connect again,
+ * or -1 if none are waiting */
+static int
+crawl_timeout(c)
+  crawl *c;
+{
+  double now = stats_clock(), due = -1;
+  int i;
+
+  for (i = 0; i < c->connections; i++) {
+    if (c->sessions[i].state == crawl_waiting && (due < 0 || c->sessions[i].retry_at < due))
+      due = c->sessions[i].retry_at;
+  }
+  if (due < 0)
+    return -1;
+  return due > now ? (int)((due - now) * 1000) + 1 : 0;
+}
+
+/* the event loop: one thread drives every session of the run, moving
+ * each along as its socket becomes ready; the writer wakes it when there
+ * is room for more ranges */
+static void *
+crawl_loop_main(arg)
+  void *arg;
+{
+  crawl *c = (crawl *)arg;
+  crawl_worker *w;
+  struct epoll_event ev, events[CRAWL_EVENTS];
+  uint64_t count;
+  int i, n, epfd, sessions, live, woken;
+
+  pthread_mutex_lock(&c->lock);
+  live = sessions = c->workers;
+  pthread_mutex_unlock(&c->lock);
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, c->wake, &ev) != 0) {
+    perror("epoll");
+    if (epfd >= 0)
+      close(epfd);
+    pthread_mutex_lock(&c->lock);
+    c->failed = 1;
+    c->workers = 0;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+  }
+
+  for (i = 0; i < sessions; i++) {
+    w = &c->sessions[i];
+    w->tries = 0;
+    if (crawl_session_start(w) != 0)
+      live -= crawl_session_retry(w, epfd);
+    else
+      live -= crawl_session_step(w, epfd);
+  }
+
+  while (live > 0) {
+    if ((n = epoll_wait(epfd, events, CRAWL_EVENTS, crawl_timeout(c))) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      pthread_mutex_lock(&c->lock);
+      c->failed = 1;
+      pthread_mutex_unlock(&c->lock);
+    }
+
+    woken = 0;
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL) {
+        if (read(c->wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+          perror("read");
+        woken = 1;
+      }
+      else {
+        live -= crawl_session_step((crawl_worker *)events[i].data.ptr, epfd);
+      }
+    }
+
+    /* the run has failed elsewhere; drop what's still in flight */
+    if (crawl_failed(c)) {
+      for (i = 0; i < sessions; i++) {
+        if (c->sessions[i].state != crawl_finished)
+          crawl_session_end(&c->sessions[i], epfd, 0);
+      }
+      break;
+    }
+    /* the writer has made room, or a session has handed ranges back;
+     * sessions waiting for ranges can go on, and those waiting to
+     * connect again may be due */
+    for (i = 0; i < sessions; i++) {
+      if (woken || c->sessions[i].state == crawl_waiting)
+        live -= crawl_session_step(&c->sessions[i], epfd);
+    }
+  }
+  close(epfd);
+  return NULL;
+}
+
+/* append a batch's replies to the capture, each with the command it
+ * answered */
+static int
+crawl_capture(c, batch)
+  crawl *c;
+  crawl_batch *batch;
+{
+  char command[64];
+  size_t from;
+  int j;
+
+  if (c->overview) {
+    if (capture_write(c->capture, c->group, batch->low, batch->high, batch->backward, batch->compressed ? "XZVER" : "XOVER",
+        batch->raw.data, batch->raw.len) != 0)
+      return 1;
+  }
+  for (j = 0, from = 0; !c->overview && headers[j] != NULL; from = batch->ends[j++]) {
+    snprintf(command, sizeof(command), "XZHDR %s", headers[j]);
+    if (capture_write(c->capture, c->group, batch->low, batch->high, batch->backward, command,
+        batch->raw.data + from, batch->ends[j] - from) != 0)
+      return 1;
+  }
+  return capture_sync(c->capture);
+}
+
+/* insert a batch and move the group's last article id up to it */
+static int
+crawl_write(c, db, batch, log)
+  crawl *c;
+  database *db;
+  crawl_batch *batch;
+  FILE *log;
+{
+  int n;
+  long long article_id = 0, missing;
+  double start;
+
+  if (log != NULL) {
+    set_timestamp();
+    fprintf(log, "%s: Headers %lld - %lld\n", timestamp, batch->low, batch->high);
+    fflush(log);
+  }
+  if (c->capture != NULL && !batch->unavailable && crawl_capture(c, batch) != 0) {
+    return 1;
+  }
+
+  if (database_begin(db) > 0) {
+    return 1;
+  }
+  start = stats_clock();
+  n = database_insert_articles(db, batch->articles, batch->count);
+  if (n > 0) {
+    article_id = batch->articles[n - 1].article_id;
+  }
+  if (c->repairing) {
+    database_clear_gap(db, c->group_id, batch->low, batch->high);
+  }
+  else if (batch->backward) {
+    database_group_set_first_article_id(db, c->group_id, batch->low, batch->high);
+  }
+  else if (article_id > 0) {
+    database_group_set_last_article_id(db, c->group_id, article_id);
+  }
+  if (batch->unavailable) {
+    database_add_gap(db, c->group_id, batch->low, batch->high, "unavailable");
+  }
+  if (batch->undecoded) {
+    database_add_gap(db, c->group_id, batch->low, batch->high, "decode");
+  }
+  /* the marks move past whatever didn't go in, so keep it as a gap */
+  if (n < batch->count) {
+    missing = batch->articles[n > 0 ? n : 0].article_id;
+    fprintf(stderr, "Couldn't insert articles %lld-%lld of %s; keeping them as a gap.\n",
+        missing, batch->articles[batch->count - 1].article_id, c->group);
+    database_add_gap(db, c->group_id, missing, batch->articles[batch->count - 1].article_id, "insert");
+  }
+  stats_time(stat_insert, stats_clock() - start);
+  start = stats_clock();
+  if (database_commit(db) > 0) {
+    return 1;
+  }
+  stats_time(stat_commit, stats_clock() - start);
+  stats_add(stat_rows, n > 0 ? n : 0);
+  stats_add(stat_batches, 1);
+  return 0;
+}
+
+/* fetch articles low..high of a group, and backfill back_high down to
+ * back_low alongside them: an event loop thread drives the crawler's
+ * sessions, decode threads parse what they read, and the calling thread
+ * writes it out in order, each direction in its own */
+int
+crawl_run(c, db, group, group_id, low, high, back_low, back_high, log)
+  crawl *c;
+  database *db;
+  const char *group;
+  long long group_id;
+  long long low;
+  long long high;
+  long long back_low;
+  long long back_high;
+  FILE *log;
+{
+  int i, res, live, connections, decoders, loop = 1;
+  long cpus;
+  long long ranges = 0;
+  double start, written;
+  crawl_worker *workers = c->sessions, w;
+  crawl_batch *batch, **next;
+
+  if (high >= low)
+    ranges += (high - low) / c->width + 1;
+  if (back_high >= back_low)
+    ranges += (back_high - back_low) / c->width + 1;
+  if (ranges == 0)
+    return 0;
+
+  /* no more sessions than ranges, and those already logged in first */
+  connections = ranges < c->connections ? (int)ranges : c->connections;
+  for (i = 0, live = 0; i < c->connections; i++) {
+    if (workers[i].n_conn != NULL) {
+      w = workers[live];
+      workers[live++] = workers[i];
+      workers[i] = w;
+    }
+  }
+
+  /* anything left over from a failed run goes back to the spares */
+  while ((batch = c->fetched) != NULL) {
+    c->fetched = batch->next;
+    crawl_batch_put(c, batch);
+  }
+  c->fetched_tail = &c->fetched;
+  while (c->retries > 0) {
+    if ((batch = c->retry[--c->retries].batch) != NULL)
+      crawl_batch_put(c, batch);
+  }
+  while ((batch = c->done) != NULL) {
+    c->done = batch->next;
+    crawl_batch_put(c, batch);
+  }
+  while ((batch = c->back_done) != NULL) {
+    c->back_done = batch->next;
+    crawl_batch_put(c, batch);
+  }
+  c->group = group;
+  c->group_id = group_id;
+  c->failed = 0;
+  c->outstanding = 0;
+  c->next = c->committed = low;
+  c->high = high;
+  c->back_low = back_low;
+  c->back_next = back_high;
+  c->back_committed = back_high + 1;
+  c->back_outstanding = 0;
+  c->max_outstanding = connections * ((c->pipeline > 0 ? c->pipeline : 1) + 1);
+  c->workers = connections;
+  if (pthread_create(&c->loop_thread, NULL, crawl_loop_main, c) != 0) {
+    fprintf(stderr, "Couldn't start session thread.\n");
+    c->workers = 0;
+    c->failed = 1;
+    loop = 0;
+  }
+
+  /* decode threads to keep up with reading, but no more than there are
+   * processors to run them */
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  c->decoders = decoders = cpus > 0 && cpus < connections ? (int)cpus : connections;
+  for (i = 0; i < decoders; i++) {
+    if (pthread_create(&c->decode_threads[i], NULL, crawl_decoder_main, c) != 0) {
+      fprintf(stderr, "Couldn't start decode thread.\n");
+      pthread_mutex_lock(&c->lock);
+      c->decoders -= decoders - i;
+      if (i == 0)
+        c->failed = 1;
+      pthread_cond_broadcast(&c->cond);
+      pthread_mutex_unlock(&c->lock);
+      crawl_wake(c);
+      decoders = i;
+      break;
+    }
+  }
+
+  /* write batches as soon as everything before them is written: below
+   * them for new articles, above them for the backfill */
+  pthread_mutex_lock(&c->lock);
+  while (1) {
+    while (!c->failed && (c->workers > 0 || c->decoders > 0) && crawl_writable(c) == NULL)
+      pthread_cond_wait(&c->cond, &c->lock);
+    if (c->failed || (next = crawl_writable(c)) == NULL)
+      break;
+
+    batch = *next;
+    *next = batch->next;
+    pthread_mutex_unlock(&c->lock);
+    start = stats_clock();
+    res = crawl_write(c, db, batch, log);
+    written = stats_clock() - start;
+    pthread_mutex_lock(&c->lock);
+
+    if (res != 0) {
+      c->failed = 1;
+    }
+    else {
+      if (batch->backward)
+        c->back_committed = batch->low;
+      else
+        c->committed = batch->high + 1;
+      crawl_adapt(c, batch, written);
+    }
+    if (batch->backward)
+      c->back_outstanding--;
+    c->outstanding--;
+    crawl_batch_put(c, batch);
+    pthread_cond_broadcast(&c->cond);
+    crawl_wake(c);
+  }
+  pthread_mutex_unlock(&c->lock);
+
+  if (loop)
+    pthread_join(c->loop_thread, NULL);
+  for (i = 0; i < decoders; i++)
+    pthread_join(c->decode_threads[i], NULL);
+
+  if (c->failed || c->committed <= c->high || c->back_committed > c->back_low) {
+    fprintf(stderr, "Couldn't fetch all articles.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* decode and write a batch read back from a capture; a set of XZHDR
+ * replies is only used if it has every field */
+static int
+crawl_replay_batch(c, db, dec, batch, replies, log)
+  crawl *c;
+  database *db;
+  nntp_decoder *dec;
+  crawl_batch *batch;
+  int replies;
+  FILE *log;
+{
+  int res = 0;
+
+  if (!c->overview && replies != NUM_HEADERS)
+    fprintf(stderr, "Skipping %s %lld-%lld, captured without all its fields.\n", c->group, batch->low, batch->high);
+  else {
+    crawl_decode(c, dec, batch);
+    res = crawl_write(c, db, batch, log);
+  }
+
+  pthread_mutex_lock(&c->lock);
+  crawl_batch_put(c, batch);
+  pthread_mutex_unlock(&c->lock);
+  return res;
+}
+
+/* feed the replies captured in dir through decoding and the inserts, in
+ * the order they were captured, without touching the network */
+int
+crawl_replay(c, db, dir, log)
+  crawl *c;
+  database *db;
+  const char *dir;
+  FILE *log;
+{
+  capture *cap;
+  capture_record rec;
+  crawl_batch *batch = NULL;
+  nntp_decoder *dec;
+  char group[256] = "";
+  int j = 0, replies = 0, overview = 0, res = 0;
+
+  if ((cap = capture_read_open(dir)) == NULL)
+    return 1;
+  if ((dec = nntp_decoder_new()) == NULL) {
+    capture_close(cap);
+    return 1;
+  }
+  c->group = group;
+
+  while (res == 0 && capture_next(cap, &rec) > 0) {
+    overview = strcmp(rec.command, "XZVER") == 0 || strcmp(rec.command, "XOVER") == 0;
+    for (j = 0; !overview && headers[j] != NULL; j++) {
+      if (strncmp(rec.command, "XZHDR ", 6) == 0 && strcmp(headers[j], rec.command + 6) == 0)
+        break;
+    }
+    if ((!overview && headers[j] == NULL) || rec.high < rec.low || rec.high - rec.low >= INT_MAX) {
+      fprintf(stderr, "Skipping captured %s %lld-%lld.\n", rec.command, rec.low, rec.high);
+      continue;
+    }
+
+    /* a range's replies come one after another, in the order they were
+     * requested; anything else ends the batch */
+    if (batch != NULL && (strcmp(rec.group, group) != 0 || rec.low != batch->low || rec.high != batch->high ||
+        rec.backward != batch->backward || overview || c->overview || j != replies)) {
+      res = crawl_replay_batch(c, db, dec, batch, replies, log);
+      batch = NULL;
+      if (res != 0)
+        break;
+    }
+    if (batch == NULL && !overview && j != 0) {
+      fprintf(stderr, "Skipping captured %s %lld-%lld without the fields before it.\n", rec.command, rec.low, rec.high);
+      continue;
+    }
+
+    if (batch == NULL) {
+      if (strcmp(rec.group, group) != 0) {
+        if ((c->group_id = database_find_or_create_group(db, rec.group)) <= 0) {
+          res = 1;
+          break;
+        }
+        snprintf(group, sizeof(group), "%s", rec.group);
+      }
+      if ((batch = crawl_batch_get(c, rec.low, rec.high)) == NULL) {
+        res = 1;
+        break;
+      }
+      c->overview = overview;
+      batch->compressed = strcmp(rec.command, "XOVER") != 0;
+      batch->backward = rec.backward;
+      replies = 0;
+    }
+    if (capture_payload(cap, &rec, &batch->raw) != 0) {
+      res = 1;
+      break;
+    }
+    stats_add(stat_bytes_wire, rec.len);
+    if (!overview)
+      batch->ends[j] = batch->raw.len;
+    replies++;
+  }
+  if (batch != NULL && res == 0) {
+    res = crawl_replay_batch(c, db, dec, batch, replies, log);
+  }
+  else if (batch != NULL) {
+    pthread_mutex_lock(&c->lock);
+    crawl_batch_put(c, batch);
+    pthread_mutex_unlock(&c->lock);
+  }
+
+  nntp_decoder_free(dec);
+  capture_close(cap);
+  c->group = NULL;
+  return res;
+}
@@ -0,0 +1,156 @@
+#ifndef _CRAWL_H
+#define _CRAWL_H
+
+#include <pthread.h>
+#include "conn.h"
+#include "article.h"
+#include "arena.h"
+#include "database.h"
+#include "fetch.h"
+#include "capture.h"
+
+#define MAX_PIPELINE 16
+/* socket events taken from epoll at a time */
+#define CRAWL_EVENTS 64
+/* default bounds on the articles per range, and what ranges are sized for:
+ * seconds to read one range's replies, and header bytes kept per range */
+#define BATCH_MIN 500
+#define BATCH_MAX 100000
+#define BATCH_LATENCY 2.0
+#define BATCH_BYTES (64 << 20)
+/* reconnecting a session that failed: seconds to wait, doubling from
+ * RETRY_MIN up to RETRY_MAX, and failures in a row before giving up */
+#define RETRY_MIN 1
+#define RETRY_MAX 60
+#define RETRY_SESSION 8
+/* failures of a range before it is split in two; a single article is
+ * given up on instead, and kept as a gap */
+#define RETRY_RANGE 3
+
+/* one range of articles: read by a session worker, decoded by a decode
+ * thread, then written in order by the writer */
+typedef struct crawl_batch {
+  long long low;
+  long long high;
+  fetch_buffer raw;         /* the replies' data blocks, still encoded */
+  size_t ends[NUM_HEADERS]; /* where each XZHDR reply's data ends in raw */
+  int compressed;           /* raw is XZVER rather than XOVER */
+  int backward;             /* part of the backfill, written newest first */
+  int unavailable;          /* the server kept failing it; nothing to insert */
+  int undecoded;            /* its replies didn't decode; nothing to insert */
+  article *articles;        /* size of them */
+  arena *arena;             /* their header strings */
+  int size;
+  int count;
+  double fetched;           /* seconds spent reading the replies */
+  struct crawl_batch *next;
+} crawl_batch;
+
+struct crawl;
+
+/* where a session is in talking to the server */
+enum crawl_states {
+  crawl_connecting,         /* TCP connect and TLS handshake */
+  crawl_greeting,           /* waiting for the server's greeting */
+  crawl_user,               /* AUTHINFO USER sent */
+  crawl_pass,               /* AUTHINFO PASS sent */
+  crawl_selecting,          /* GROUP sent */
+  crawl_fetching,           /* reading ranges' replies */
+  crawl_waiting,            /* backing off before reconnecting */
+  crawl_finished            /* done with the group, or given up */
+};
+
+typedef struct {
+  long long low;
+  long long high;
+  int requested;            /* its commands have been sent */
+  int backward;
+  int failures;             /* times the server failed it */
+  struct crawl_batch *batch; /* replies read before a session dropped it */
+  int done;                 /* how many of them there are */
+} crawl_range;
+
+/* a session to the server; it stays connected from one group to the next.
+ * The event loop drives all of them from one thread, each as a state
+ * machine that moves on as replies come in. */
+typedef struct {
+  struct crawl *c;
+  nntp_conn *n_conn;        /* NULL until logged in, or after a failure */
+  enum crawl_states state;
+  int compressed;           /* overview comes as XZVER rather than XOVER */
+  int probed;               /* the server has answered an overview command */
+  int events;               /* what epoll watches its socket for */
+  crawl_range ranges[MAX_PIPELINE]; /* ranges claimed, oldest first */
+  int head;
+  int pending;
+  crawl_batch *batch;       /* the oldest range's replies, while reading */
+  int reply;                /* replies of it read so far */
+  int in_block;             /* reading a reply's data block */
+  double started;           /* start of the step being timed */
+  double fetch_start;       /* when reading the oldest range began */
+  int tries;                /* failures in a row */
+  int refused;              /* the server failed the oldest range */
+  double retry_at;          /* when to reconnect, while waiting */
+} crawl_worker;
+
+/* shared state between the session workers, decode threads and writer */
+typedef struct crawl {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  /* range scheduler */
+  long long next;           /* first article id of the next range */
+  long long high;           /* last article id to fetch */
+  long long width;          /* articles per range, adapted as we go */
+  long long width_min;
+  long long width_max;
+  long long committed;      /* every range below this has been written */
+  int outstanding;          /* ranges handed out but not yet written */
+  int max_outstanding;
+  crawl_batch *fetched;     /* read batches waiting to be decoded */
+  crawl_batch **fetched_tail;
+  crawl_batch *done;        /* decoded batches, sorted by low */
+
+  /* backfill: ranges below the new articles, handed out newest first
+   * alongside them */
+  long long back_next;      /* last article id of the next range */
+  long long back_low;       /* first article id to backfill */
+  long long back_committed; /* every range from here up has been written */
+  int back_outstanding;
+  crawl_batch *back_done;   /* decoded batches, highest first */
+
+  crawl_batch *spare;       /* written batches, ready for reuse */
+  crawl_range *retry;       /* ranges handed back by failed sessions */
+  int retries;
+  int retry_size;
+
+  int workers;              /* sessions still running */
+  int decoders;             /* decode threads still running */
+  pthread_t loop_thread;    /* drives the sessions */
+  pthread_t *decode_threads;
+  int wake;                 /* eventfd to get the loop's attention */
+  int failed;
+
+  /* the group being crawled */
+  const char *group;
+  long long group_id;
+
+  /* session setup, shared by all workers */
+  const char *server;
+  const char *user;
+  const char *password;
+  int pipeline;
+  int overview;             /* fetch XZVER/XOVER instead of XZHDR */
+  capture *capture;         /* where to keep the replies, if anywhere */
+  int repairing;            /* refetching gaps: clear them, not the marks */
+  crawl_worker *sessions;
+  int connections;
+} crawl;
+
+crawl *crawl_new(const char *, const char *, const char *, nntp_conn *, int, int, int, long long, long long);
+void crawl_free(crawl *);
+int crawl_run(crawl *, database *, const char *, long long, long long, long long, long long, long long, FILE *);
+int crawl_poll(crawl *, const char *, long long *, long long *);
+int crawl_replay(crawl *, database *, const char *, FILE *);
+
+#endif
@@ -40,6 +40,24 @@ database_close(db)
   }
 }
 
+/* journal mode, synchronous and cache size for ingesting, and whether to
+ * keep the Date text; a NULL synchronous or zero cache_size leaves that
+ * setting alone */
+int
+database_configure(db, wal, synchronous, cache_size, date_text)
+  database *db;
+  int wal;
+  const char *synchronous;
+  int cache_size;
+  int date_text;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_configure(db, wal, synchronous, cache_size, date_text);
+  }
+  return 1;
+}
+
 long long
 database_find_or_create_group(db, group)
   database *db;
@@ -98,6 +116,21 @@ database_insert_article(db, a)
   return -1;
 }
 
+/* insert count articles, stopping at the first failure; returns how
+ * many were inserted */
+int
+database_insert_articles(db, a, count)
+  database *db;
+  article *a;
+  int count;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_insert_articles(db, a, count);
+  }
+  return 0;
+}
+
 int
 database_group_set_last_article_id(db, group_id, article_id)
   database *db;
@@ -110,3 +143,78 @@ database_group_set_last_article_id(db, group_id, article_id)
   }
   return -1;
 }
+
+/* the lowest article stored for a group being backfilled, or 0 if it has
+ * been crawled from its low mark up */
+long long
+database_first_article_id_for_group(db, group_id)
+  database *db;
+  long long group_id;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_first_article_id_for_group(db, group_id);
+  }
+  return -1;
+}
+
+/* move a group's backfill down to low, after writing low..high */
+int
+database_group_set_first_article_id(db, group_id, low, high)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_group_set_first_article_id(db, group_id, low, high);
+  }
+  return -1;
+}
+
+/* remember that a group's articles low..high are missing, and why */
+int
+database_add_gap(db, group_id, low, high, reason)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+  const char *reason;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_add_gap(db, group_id, low, high, reason);
+  }
+  return -1;
+}
+
+/* forget the gaps in a group's articles low..high, once they're fetched */
+int
+database_clear_gap(db, group_id, low, high)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_clear_gap(db, group_id, low, high);
+  }
+  return -1;
+}
+
+/* a group's gaps, lowest first, in a malloced array; returns how many,
+ * or -1 */
+int
+database_gaps_for_group(db, group_id, gaps)
+  database *db;
+  long long group_id;
+  database_gap **gaps;
+{
+  switch (db->db_type) {
+    case sqlite:
+      return database_sqlite_gaps_for_group(db, group_id, gaps);
+  }
+  return -1;
+}
@@ -11,27 +11,66 @@
 enum stmt_types {
   blank_stmt,
   tmp_stmt,
-  insert_article_stmt
+  find_group_stmt,
+  create_group_stmt,
+  last_article_id_stmt,
+  set_last_article_id_stmt,
+  first_article_id_stmt,
+  set_first_article_id_stmt,
+  add_gap_stmt,
+  gaps_stmt,
+  insert_article_stmt,
+  insert_articles_stmt,
+  find_file_stmt,
+  count_file_stmt,
+  find_message_id_stmt,
+  link_posting_stmt,
+  find_poster_stmt,
+  create_poster_stmt,
+  num_stmt_types
 };
 
+/* rows per multi-row INSERT */
+#define INSERT_ROWS 64
+
+/* poster ids kept in memory */
+#define POSTER_CACHE 65536
+
+/* a range of a group's articles that we don't have */
+typedef struct {
+  long long low;
+  long long high;
+} database_gap;
+
 enum db_types {
   sqlite
 };
 
 typedef struct {
   void *s_db;
-  void *s_stmt;
+  void *s_stmt;                       /* statement last prepared */
+  void *s_stmts[num_stmt_types];      /* prepared statements, by type */
   enum db_types db_type;
   enum stmt_types stmt_type;
+  int date_text;                      /* store posted_at along with posted */
+  void *message_ids;                  /* bloom filter of the stored Message-IDs */
+  void *posters;                      /* poster -> id, for the last posters seen */
 } database;
 
 database *database_open(enum db_types, ...);
 void database_close(database *);
+int database_configure(database *, int, const char *, int, int);
 long long database_find_or_create_group(database *, const char *);
 long long database_last_article_id_for_group(database *, long long);
 int database_begin(database *);
 int database_commit(database *);
 long long database_insert_article(database *, article *);
+int database_insert_articles(database *, article *, int);
 int database_group_set_last_article_id(database *, long long, long long);
+long long database_first_article_id_for_group(database *, long long);
+int database_group_set_first_article_id(database *, long long, long long, long long);
+int database_add_gap(database *, long long, long long, long long, const char *);
+int database_clear_gap(database *, long long, long long, long long);
+int database_gaps_for_group(database *, long long, database_gap **);
 
 #endif
@@ -0,0 +1,259 @@
+#include "date.h"
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+#define IS_ALPHA(c) (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'z')
+#define LOWER3(s) ((((s)[0] | 0x20) << 16) | (((s)[1] | 0x20) << 8) | ((s)[2] | 0x20))
+#define KEY3(a, b, c) (((a) << 16) | ((b) << 8) | (c))
+
+typedef struct {
+  const char *s;
+  const char *end;
+} date_cursor;
+
+static void
+date_skip(c)
+  date_cursor *c;
+{
+  while (c->s < c->end && (IS_SPACE(*c->s) || *c->s == ','))
+    c->s++;
+}
+
+/* read up to max digits; returns -1 if there are none */
+static int
+date_number(c, max)
+  date_cursor *c;
+  int max;
+{
+  int n = 0, i = 0;
+
+  while (c->s < c->end && IS_DIGIT(*c->s) && i < max) {
+    n = n * 10 + (*c->s++ - '0');
+    i++;
+  }
+  return i == 0 ? -1 : n;
+}
+
+/* read a word of letters, returning its length */
+static int
+date_word(c, w)
+  date_cursor *c;
+  const char **w;
+{
+  *w = c->s;
+  while (c->s < c->end && IS_ALPHA(*c->s))
+    c->s++;
+  return c->s - *w;
+}
+
+/* month from its name or the first three letters of it, 1-12, or 0 */
+static int
+date_month(w, len)
+  const char *w;
+  int len;
+{
+  if (len < 3)
+    return 0;
+  switch (LOWER3(w)) {
+    case KEY3('j', 'a', 'n'): return 1;
+    case KEY3('f', 'e', 'b'): return 2;
+    case KEY3('m', 'a', 'r'): return 3;
+    case KEY3('a', 'p', 'r'): return 4;
+    case KEY3('m', 'a', 'y'): return 5;
+    case KEY3('j', 'u', 'n'): return 6;
+    case KEY3('j', 'u', 'l'): return 7;
+    case KEY3('a', 'u', 'g'): return 8;
+    case KEY3('s', 'e', 'p'): return 9;
+    case KEY3('o', 'c', 't'): return 10;
+    case KEY3('n', 'o', 'v'): return 11;
+    case KEY3('d', 'e', 'c'): return 12;
+  }
+  return 0;
+}
+
+/* offset of a zone name in seconds; unknown names (including the
+ * military letters, which RFC 5322 says to treat as -0000) are UTC */
+static int
+date_zone_name(w, len)
+  const char *w;
+  int len;
+{
+  if (len != 3)
+    return 0;
+  switch (LOWER3(w)) {
+    case KEY3('e', 'd', 't'): return -4 * 3600;
+    case KEY3('e', 's', 't'):
+    case KEY3('c', 'd', 't'): return -5 * 3600;
+    case KEY3('c', 's', 't'):
+    case KEY3('m', 'd', 't'): return -6 * 3600;
+    case KEY3('m', 's', 't'):
+    case KEY3('p', 'd', 't'): return -7 * 3600;
+    case KEY3('p', 's', 't'): return -8 * 3600;
+    case KEY3('c', 'e', 't'): return 3600;
+    case KEY3('e', 'e', 't'): return 2 * 3600;
+  }
+  return 0;
+}
+
+/* [+-]hhmm or [+-]hh:mm, or a name optionally followed by one */
+static int
+date_zone(c, offset)
+  date_cursor *c;
+  int *offset;
+{
+  const char *w;
+  int len, sign, hh, mm;
+
+  *offset = 0;
+  date_skip(c);
+  if (c->s < c->end && IS_ALPHA(*c->s)) {
+    len = date_word(c, &w);
+    *offset = date_zone_name(w, len);
+  }
+  if (c->s + 1 < c->end && (*c->s == '+' || *c->s == '-') && IS_DIGIT(c->s[1])) {
+    sign = *c->s++ == '-' ? -1 : 1;
+    w = c->s;
+    hh = date_number(c, 2);
+    if (c->s < c->end && *c->s == ':')
+      c->s++;
+    mm = c->s - w == 1 ? 0 : date_number(c, 2);
+    if (hh > 23 || mm > 59)
+      return 0;
+    *offset += sign * (hh * 3600 + (mm < 0 ? 0 : mm * 60));
+  }
+  return 1;
+}
+
+/* hh:mm[:ss[.fraction]] */
+static int
+date_time(c, hour, min, sec)
+  date_cursor *c;
+  int *hour;
+  int *min;
+  int *sec;
+{
+  date_skip(c);
+  if ((*hour = date_number(c, 2)) < 0 || c->s >= c->end || *c->s++ != ':')
+    return 0;
+  if ((*min = date_number(c, 2)) < 0)
+    return 0;
+  *sec = 0;
+  if (c->s < c->end && *c->s == ':') {
+    c->s++;
+    if ((*sec = date_number(c, 2)) < 0)
+      return 0;
+    if (c->s < c->end && *c->s == '.') {
+      c->s++;
+      while (c->s < c->end && IS_DIGIT(*c->s))
+        c->s++;
+    }
+  }
+  return *hour < 24 && *min < 60 && *sec <= 60;
+}
+
+/* days from 1970-01-01 to a date of the proleptic Gregorian calendar */
+static long long
+date_days(y, m, d)
+  long long y;
+  int m;
+  int d;
+{
+  long long era, yoe, doy;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+int
+date_parse(s, len, t)
+  const char *s;
+  int len;
+  long long *t;
+{
+  date_cursor c;
+  const char *w;
+  int wlen, year = -1, month = 0, day = -1, hour, min, sec, offset = 0, digits;
+
+  c.s = s;
+  c.end = s + len;
+  date_skip(&c);
+
+  /* a weekday, if any, tells us nothing */
+  if (c.s < c.end && IS_ALPHA(*c.s)) {
+    wlen = date_word(&c, &w);
+    if ((month = date_month(w, wlen)) == 0) {
+      date_skip(&c);
+      if (c.s < c.end && IS_ALPHA(*c.s)) {
+        wlen = date_word(&c, &w);
+        month = date_month(w, wlen);
+        if (month == 0)
+          return 0;
+      }
+    }
+    if (c.s < c.end && *c.s == '.')
+      c.s++;
+  }
+
+  if (month != 0) {
+    /* asctime(): Mon Jan  2 15:04:05 [zone] 2006 */
+    date_skip(&c);
+    if ((day = date_number(&c, 2)) < 0 || !date_time(&c, &hour, &min, &sec))
+      return 0;
+    date_skip(&c);
+    if (c.s < c.end && !IS_DIGIT(*c.s) && !date_zone(&c, &offset))
+      return 0;
+    date_skip(&c);
+    w = c.s;
+    year = date_number(&c, 4);
+    digits = c.s - w;
+  }
+  else {
+    w = c.s;
+    if ((day = date_number(&c, 4)) < 0)
+      return 0;
+    if (c.s - w == 4 && c.s < c.end && *c.s == '-') {
+      /* ISO 8601: 2006-01-02[T ]15:04:05[zone] */
+      year = day;
+      digits = 4;
+      c.s++;
+      if ((month = date_number(&c, 2)) < 0 || c.s >= c.end || *c.s++ != '-')
+        return 0;
+      if ((day = date_number(&c, 2)) < 0)
+        return 0;
+      if (c.s < c.end && (*c.s == 'T' || *c.s == 't'))
+        c.s++;
+    }
+    else {
+      /* RFC 5322: 2 Jan 2006 15:04:05 zone, also with dashes */
+      date_skip(&c);
+      if (c.s < c.end && *c.s == '-')
+        c.s++;
+      wlen = date_word(&c, &w);
+      if ((month = date_month(w, wlen)) == 0)
+        return 0;
+      if (c.s < c.end && (*c.s == '-' || *c.s == '.'))
+        c.s++;
+      date_skip(&c);
+      w = c.s;
+      year = date_number(&c, 4);
+      digits = c.s - w;
+    }
+    if (!date_time(&c, &hour, &min, &sec) || !date_zone(&c, &offset))
+      return 0;
+  }
+
+  if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31)
+    return 0;
+  /* RFC 5322 4.3: two digit years below 50 are 20xx, three digit ones
+   * are counted from 1900 */
+  if (digits <= 2)
+    year += year < 50 ? 2000 : 1900;
+  else if (digits == 3)
+    year += 1900;
+
+  *t = date_days(year, month, day) * 86400 + hour * 3600 + min * 60 + sec - offset;
+  return 1;
+}
@@ -0,0 +1,11 @@
+#ifndef _DATE_H
+#define _DATE_H
+
+/* Parse a Date header into seconds since the epoch, UTC.  Takes RFC 5322
+ * dates and the usual deviations from them: no or misspelt weekday, two
+ * digit years, missing seconds, named or missing zones, asctime() dates
+ * and ISO 8601.  Returns 1 and sets *t if the date could be read, 0 if
+ * not; nothing is allocated. */
+int date_parse(const char *, int, long long *);
+
+#endif
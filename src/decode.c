@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include "main.h"
+#include "decode.h"
+#include "yenc.h"
+#include "stats.h"
+
+nntp_decoder *
+nntp_decoder_new()
+{
+  nntp_decoder *dec;
+
+  dec = (nntp_decoder *)malloc(sizeof(nntp_decoder));
+  if (dec == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  dec->in = (unsigned char *)malloc(sizeof(unsigned char) * CHUNK);
+  dec->out = (char *)malloc(sizeof(char) * CHUNK);
+  if (dec->in == NULL || dec->out == NULL) {
+    free(dec->in);
+    free(dec->out);
+    free(dec);
+    perror("malloc");
+    return NULL;
+  }
+
+  /* allocate inflate state */
+  dec->strm.zalloc = Z_NULL;
+  dec->strm.zfree = Z_NULL;
+  dec->strm.opaque = Z_NULL;
+  dec->strm.avail_in = 0;
+  dec->strm.next_in = Z_NULL;
+  if (inflateInit2(&dec->strm, -15) != Z_OK) {
+    free(dec->in);
+    free(dec->out);
+    free(dec);
+    fprintf(stderr, "inflateInit failed.\n");
+    return NULL;
+  }
+
+  dec->state = yenc_begin;
+  dec->inflated = 0;
+  dec->out_len = 0;
+  dec->parse_time = 0;
+  return dec;
+}
+
+void
+nntp_decoder_free(dec)
+  nntp_decoder *dec;
+{
+  (void)inflateEnd(&dec->strm);
+  free(dec->in);
+  free(dec->out);
+  free(dec);
+}
+
+/* get ready for the next stream */
+int
+nntp_decoder_reset(dec)
+  nntp_decoder *dec;
+{
+  dec->state = yenc_begin;
+  dec->inflated = 0;
+  dec->out_len = 0;
+  dec->parse_time = 0;
+  if (inflateReset(&dec->strm) != Z_OK) {
+    fprintf(stderr, "inflateReset failed.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* hand out complete records from the output buffer and keep the rest */
+static int
+nntp_decoder_emit(dec, cb, arg)
+  nntp_decoder *dec;
+  nntp_record_cb cb;
+  void *arg;
+{
+  char *rec = dec->out, *end = dec->out + dec->out_len, *eol = dec->out;
+  double start = stats_clock();
+
+  while ((eol = (char *)memchr(eol, '\n', end - eol)) != NULL) {
+    if (eol > rec && eol[-1] == '\r') {
+      cb(arg, rec, eol + 1 - rec);
+      rec = eol + 1;
+    }
+    eol++;
+  }
+  dec->parse_time += stats_clock() - start;
+
+  dec->out_len = end - rec;
+  if (dec->out_len == CHUNK) {
+    fprintf(stderr, "Header record too long.\n");
+    return 1;
+  }
+  memmove(dec->out, rec, dec->out_len);
+  return 0;
+}
+
+/* inflate len bytes of dec->in */
+static int
+nntp_decoder_inflate(dec, len, cb, arg)
+  nntp_decoder *dec;
+  size_t len;
+  nntp_record_cb cb;
+  void *arg;
+{
+  int ret;
+
+  if (dec->inflated) {
+    /* anything after the end of the stream is ignored */
+    return 0;
+  }
+
+  dec->strm.avail_in = len;
+  dec->strm.next_in = dec->in;
+  do {
+    dec->strm.avail_out = CHUNK - dec->out_len;
+    dec->strm.next_out = (unsigned char *)dec->out + dec->out_len;
+    ret = inflate(&dec->strm, Z_NO_FLUSH);
+    assert(ret != Z_STREAM_ERROR);
+    switch (ret) {
+      case Z_NEED_DICT:
+        ret = Z_DATA_ERROR;     /* and fall through */
+      case Z_DATA_ERROR:
+      case Z_MEM_ERROR:
+        fprintf(stderr, "Inflate failed: %d\n", ret);
+        return 1;
+    }
+
+    dec->out_len = CHUNK - dec->strm.avail_out;
+    if (nntp_decoder_emit(dec, cb, arg) != 0) {
+      return 1;
+    }
+    if (ret == Z_STREAM_END) {
+      dec->inflated = 1;
+      break;
+    }
+  } while (dec->strm.avail_in > 0 || dec->strm.avail_out == 0);
+
+  return 0;
+}
+
+/* decode the next complete lines of a stream, handing out every complete
+ * record that comes out of them */
+int
+nntp_decoder_feed(dec, data, len, cb, arg)
+  nntp_decoder *dec;
+  const char *data;
+  size_t len;
+  nntp_record_cb cb;
+  void *arg;
+{
+  const char *tail = data, *end = data + len, *eol;
+  size_t in_len, piece, consumed, ylen = strlen(YENC_LINE) - 2;
+  int ended;
+
+  while (tail < end && dec->state != yenc_end) {
+    if (dec->state == yenc_begin) {
+      /* verify yenc info */
+      eol = (const char *)memchr(tail, '\n', end - tail);
+      if (eol == NULL)
+        eol = end;
+      piece = eol - tail;
+      if (piece > 0 && tail[piece - 1] == '\r')
+        piece--;
+      if (piece != ylen || strncmp(tail, YENC_LINE, ylen) != 0) {
+        fprintf(stderr, "Bad header format: %.*s\n", (int) piece, tail);
+        return 1;
+      }
+      dec->state = yenc_data;
+      tail = eol + 1;
+      continue;
+    }
+
+    /* decode as many whole lines as the inflate buffer holds */
+    piece = end - tail;
+    if (piece > CHUNK) {
+      eol = (const char *)memrchr(tail, '\n', CHUNK);
+      if (eol == NULL) {
+        fprintf(stderr, "yEnc line too long.\n");
+        return 1;
+      }
+      piece = eol + 1 - tail;
+    }
+    in_len = yenc_decode(dec->in, tail, piece, &consumed, &ended);
+    if (ended)
+      dec->state = yenc_end;
+    tail += piece;
+
+    if (nntp_decoder_inflate(dec, in_len, cb, arg) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* check that the stream was complete, and ended with a whole record */
+int
+nntp_decoder_finish(dec)
+  nntp_decoder *dec;
+{
+  if (!dec->inflated) {
+    fprintf(stderr, "Premature end.\n");
+    return 1;
+  }
+  if (dec->out_len > 0) {
+    fprintf(stderr, "Invalid header record found.\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* hand out the records of an uncompressed data block, made of complete
+ * lines, undoing dot-stuffing on the way */
+void
+nntp_records_feed(data, len, cb, arg)
+  const char *data;
+  size_t len;
+  nntp_record_cb cb;
+  void *arg;
+{
+  const char *rec = data, *end = data + len, *eol;
+
+  while (rec < end && (eol = (const char *)memchr(rec, '\n', end - rec)) != NULL) {
+    if (*rec == '.')
+      rec++;
+    cb(arg, rec, eol + 1 - rec);
+    rec = eol + 1;
+  }
+}
+
+typedef struct {
+  char *head;
+  size_t len;
+  size_t size;
+} decode_buffer;
+
+static void
+nntp_decode_append(arg, rec, len)
+  void *arg;
+  const char *rec;
+  size_t len;
+{
+  decode_buffer *buf = (decode_buffer *)arg;
+  char *new_head;
+
+  if (buf->head == NULL)
+    return;
+
+  if (buf->len + len + 1 > buf->size) {
+    while (buf->len + len + 1 > buf->size)
+      buf->size += CHUNK;
+    new_head = (char *)realloc((void *)buf->head, buf->size);
+    if (new_head == NULL) {
+      fprintf(stderr, "Couldn't reallocate result data.\n");
+      free(buf->head);
+      buf->head = NULL;
+      return;
+    }
+    buf->head = new_head;
+  }
+  memcpy(buf->head + buf->len, rec, len);
+  buf->len += len;
+}
+
+/* decode a whole compressed header stream at once into a string of
+ * records */
+char *
+nntp_decode_headers(data)
+  const char *data;
+{
+  nntp_decoder *dec;
+  decode_buffer buf;
+  int res;
+
+  if ((dec = nntp_decoder_new()) == NULL) {
+    return NULL;
+  }
+
+  buf.len = 0;
+  buf.size = CHUNK;
+  buf.head = (char *)malloc(sizeof(char) * buf.size);
+  if (buf.head == NULL) {
+    nntp_decoder_free(dec);
+    fprintf(stderr, "Couldn't allocate result data.\n");
+    return NULL;
+  }
+
+  res = nntp_decoder_feed(dec, data, strlen(data), nntp_decode_append, &buf);
+  if (res == 0)
+    res = nntp_decoder_finish(dec);
+  nntp_decoder_free(dec);
+
+  if (res != 0 || buf.head == NULL) {
+    free(buf.head);
+    return NULL;
+  }
+  buf.head[buf.len] = 0;
+  return buf.head;
+}
@@ -0,0 +1,35 @@
+#ifndef _DECODE_H
+#define _DECODE_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+/* called with each complete "<article id> <value>\r\n" header record */
+typedef void (*nntp_record_cb)(void *, const char *, size_t);
+
+enum yenc_states {
+  yenc_begin,
+  yenc_data,
+  yenc_end
+};
+
+/* incremental yEnc + inflate decoder for compressed header streams */
+typedef struct {
+  z_stream strm;
+  enum yenc_states state;
+  int inflated;          /* inflate reached the end of the stream */
+  unsigned char *in;     /* yEnc-decoded data waiting to be inflated */
+  char *out;             /* inflated data not yet handed out as records */
+  size_t out_len;
+  double parse_time;     /* spent in the record callback since the reset */
+} nntp_decoder;
+
+nntp_decoder *nntp_decoder_new();
+void nntp_decoder_free(nntp_decoder *);
+int nntp_decoder_reset(nntp_decoder *);
+int nntp_decoder_feed(nntp_decoder *, const char *, size_t, nntp_record_cb, void *);
+int nntp_decoder_finish(nntp_decoder *);
+char *nntp_decode_headers(const char *);
+void nntp_records_feed(const char *, size_t, nntp_record_cb, void *);
+
+#endif
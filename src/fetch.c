@@ -0,0 +1,384 @@
+#include "main.h"
+#include "fetch.h"
+#include "subject.h"
+#include "date.h"
+#include "stats.h"
+
+char *headers[] = {
+  "Subject", "Message-ID",
+  "From", "Date", "Bytes",
+  NULL
+};
+
+/* queue XZHDR commands for n fields of headers[], starting at index
+ * first, to go out in a single write; the replies come back in the same
+ * order */
+int
+request_headers(n_conn, first, n, low, high)
+  nntp_conn *n_conn;
+  int first;
+  int n;
+  long long low;
+  long long high;
+{
+  int j, len = 0;
+  char cmd[1024];
+
+  for (j = first; j < first + n && headers[j] != NULL; j++) {
+    len += snprintf(cmd + len, sizeof(cmd) - len, "XZHDR %s %lld-%lld\r\n", headers[j], low, high);
+  }
+  return nntp_queue(n_conn, cmd);
+}
+
+typedef struct {
+  article *articles;
+  arena *arena;
+  const char *hdr;
+  long long low;
+  long long high;
+  long long group_id;
+  int update;
+  int count;
+  int status;   /* 0 while parsing, 1 once stopped, -1 on failure */
+} header_parser;
+
+/* read the article id a record starts with, and check that it belongs to
+ * the range being parsed; returns 0 if it doesn't */
+static long long
+parse_article_id(p, rec, tail)
+  header_parser *p;
+  const char *rec;
+  char **tail;
+{
+  long long article_id;
+
+  article_id = strtoll(rec, tail, 10);
+  if (article_id == 0) {
+    fprintf(stderr, "Invalid article id.\n");
+    p->status = 1;
+    return 0;
+  }
+  if (article_id < p->low || article_id > p->high || p->count > p->high - p->low) {
+    /* reply doesn't belong to the command we think it does */
+    fprintf(stderr, "Article %lld outside of range %lld-%lld.\n", article_id, p->low, p->high);
+    p->status = -1;
+    return 0;
+  }
+  return article_id;
+}
+
+/* store one "<article id> <value>\r\n" record */
+static void
+parse_header_record(arg, rec, rlen)
+  void *arg;
+  const char *rec;
+  size_t rlen;
+{
+  header_parser *p = (header_parser *)arg;
+  article *a;
+  long long article_id;
+  const char *h_tail = rec + rlen - 2, *value;
+  char *h_cur;
+  int len;
+
+  if (p->status != 0)
+    return;
+
+  if ((article_id = parse_article_id(p, rec, &h_cur)) == 0)
+    return;
+
+  while (*h_cur == ' ')
+    h_cur++;
+
+  a = &p->articles[p->count];
+  if (p->update == 0) {
+    a->article_id = article_id;
+    a->group_id = p->group_id;
+    a->nlen = a->part = a->total = 0;
+    a->file_id = 0;
+    a->posted = 0;
+  }
+  else if (a->article_id != article_id) {
+    fprintf(stderr, "Article doesn't match.\n");
+    p->status = 1;
+    return;
+  }
+
+  len = h_tail - h_cur;
+  if (strcmp(p->hdr, "Bytes") == 0) {
+    a->bytes = strtoll(h_cur, NULL, 10);
+    p->count++;
+    return;
+  }
+
+  if ((value = arena_copy(p->arena, h_cur, len)) == NULL) {
+    p->status = -1;
+    return;
+  }
+  if (strcmp(p->hdr, "Subject") == 0) {
+    a->subject = value;
+    a->slen = len;
+    if (!subject_parse(value, len, &a->nlen, &a->part, &a->total))
+      a->nlen = a->part = a->total = 0;
+  }
+  else if (strcmp(p->hdr, "Message-ID") == 0) {
+    a->message_id = value;
+    a->mlen = len;
+  }
+  else if (strcmp(p->hdr, "From") == 0) {
+    a->poster = value;
+    a->plen = len;
+  }
+  else if (strcmp(p->hdr, "Date") == 0) {
+    a->posted_at = value;
+    a->wlen = len;
+    if (!date_parse(value, len, &a->posted))
+      a->posted = 0;
+  }
+
+  p->count++;
+}
+
+/* store one overview record: number, subject, from, date, message-id,
+ * references, bytes and lines, separated by tabs */
+static void
+parse_overview_record(arg, rec, rlen)
+  void *arg;
+  const char *rec;
+  size_t rlen;
+{
+  header_parser *p = (header_parser *)arg;
+  article *a;
+  const char *fields[OVERVIEW_FIELDS], *end = rec + rlen - 2, *tab;
+  char *h_cur;
+  int i, len[OVERVIEW_FIELDS];
+
+  if (p->status != 0)
+    return;
+
+  if (parse_article_id(p, rec, &h_cur) == 0)
+    return;
+
+  /* split the fields after the number */
+  if (*h_cur++ != '\t') {
+    fprintf(stderr, "Invalid overview record found.\n");
+    p->status = 1;
+    return;
+  }
+  for (i = 0; i < OVERVIEW_FIELDS; i++) {
+    tab = (const char *)memchr(h_cur, '\t', end - h_cur);
+    fields[i] = h_cur;
+    len[i] = (tab == NULL ? end : tab) - h_cur;
+    if (tab == NULL)
+      break;
+    h_cur = (char *)tab + 1;
+  }
+  if (i < OVERVIEW_BYTES) {
+    fprintf(stderr, "Invalid overview record found.\n");
+    p->status = 1;
+    return;
+  }
+
+  a = &p->articles[p->count];
+  a->article_id = strtoll(rec, NULL, 10);
+  a->group_id = p->group_id;
+  a->subject = arena_copy(p->arena, fields[OVERVIEW_SUBJECT], len[OVERVIEW_SUBJECT]);
+  a->slen = len[OVERVIEW_SUBJECT];
+  a->poster = arena_copy(p->arena, fields[OVERVIEW_FROM], len[OVERVIEW_FROM]);
+  a->plen = len[OVERVIEW_FROM];
+  a->posted_at = arena_copy(p->arena, fields[OVERVIEW_DATE], len[OVERVIEW_DATE]);
+  a->wlen = len[OVERVIEW_DATE];
+  a->message_id = arena_copy(p->arena, fields[OVERVIEW_MESSAGE_ID], len[OVERVIEW_MESSAGE_ID]);
+  a->mlen = len[OVERVIEW_MESSAGE_ID];
+  a->bytes = strtoll(fields[OVERVIEW_BYTES], NULL, 10);
+  a->file_id = 0;
+  if (!date_parse(fields[OVERVIEW_DATE], len[OVERVIEW_DATE], &a->posted))
+    a->posted = 0;
+  if (a->subject == NULL || a->poster == NULL || a->posted_at == NULL || a->message_id == NULL) {
+    p->status = -1;
+    return;
+  }
+  if (!subject_parse(a->subject, a->slen, &a->nlen, &a->part, &a->total))
+    a->nlen = a->part = a->total = 0;
+
+  p->count++;
+}
+
+/* add a piece of a reply's data block to the end of buf, as it came off
+ * the wire */
+int
+fetch_append(buf, data, len)
+  fetch_buffer *buf;
+  const char *data;
+  size_t len;
+{
+  size_t size;
+  char *new_data;
+
+  if (buf->len + len > buf->size) {
+    for (size = buf->size > 0 ? buf->size : CHUNK; size < buf->len + len; size *= 2);
+    if ((new_data = (char *)realloc(buf->data, size)) == NULL) {
+      perror("realloc");
+      return -1;
+    }
+    buf->data = new_data;
+    buf->size = size;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return 0;
+}
+
+/* run a data block through the parser, decompressing it first when a
+ * decoder is given */
+static int
+decode_records(dec, data, len, cb, p)
+  nntp_decoder *dec;
+  const char *data;
+  size_t len;
+  nntp_record_cb cb;
+  header_parser *p;
+{
+  int res = 0;
+  double start = stats_clock(), elapsed;
+
+  /* an empty reply, to a range with no articles, has nothing to inflate */
+  if (dec != NULL && len > 0) {
+    res = nntp_decoder_reset(dec);
+    if (res == 0)
+      res = nntp_decoder_feed(dec, data, len, cb, p);
+    if (res == 0)
+      res = nntp_decoder_finish(dec);
+    elapsed = stats_clock() - start;
+    stats_time(stat_decode, elapsed - dec->parse_time);
+    stats_time(stat_parse, dec->parse_time);
+    stats_add(stat_bytes_decoded, (long long)dec->strm.total_out);
+  }
+  else {
+    nntp_records_feed(data, len, cb, p);
+    stats_time(stat_parse, stats_clock() - start);
+    stats_add(stat_bytes_decoded, (long long)len);
+  }
+  if (p->update == 0)
+    stats_add(stat_articles, p->count);
+
+  if (res != 0 || p->status < 0) {
+    return -1;
+  }
+  return p->count;
+}
+
+/* check the status line of an XZHDR reply; 0 means its data block
+ * follows, -1 is left to the caller to report */
+int
+accept_headers(n_res)
+  nntp_response *n_res;
+{
+  if (n_res->status != NNTP_XZHDR_OK) {
+    return -1;
+  }
+  return 0;
+}
+
+/* decode and parse the data of an XZHDR reply into articles */
+int
+decode_headers(dec, data, len, articles, ar, hdr, low, high, group_id, update)
+  nntp_decoder *dec;
+  const char *data;
+  size_t len;
+  article *articles;
+  arena *ar;
+  const char *hdr;
+  long long low;
+  long long high;
+  long long group_id;
+  int update;
+{
+  header_parser p;
+
+  p.articles = articles;
+  p.arena = ar;
+  p.hdr = hdr;
+  p.low = low;
+  p.high = high;
+  p.group_id = group_id;
+  p.update = update;
+  p.count = 0;
+  p.status = 0;
+
+  if (decode_records(dec, data, len, parse_header_record, &p) < 0) {
+    fprintf(stderr, "Couldn't decode headers.\n");
+    return -1;
+  }
+
+#ifdef DEBUG
+  fprintf(stderr, "Number of valid headers for this batch: %d.\n", p.count);
+#endif
+  return p.count;
+}
+
+/* queue an XZVER (or, uncompressed, XOVER) command for a range */
+int
+request_overview(n_conn, compressed, low, high)
+  nntp_conn *n_conn;
+  int compressed;
+  long long low;
+  long long high;
+{
+  char cmd[1024];
+
+  snprintf(cmd, sizeof(cmd), "%s %lld-%lld\r\n", compressed ? "XZVER" : "XOVER", low, high);
+  return nntp_queue(n_conn, cmd);
+}
+
+/* check the status line of an XZVER/XOVER reply; 0 means its data block
+ * follows, -2 that the server doesn't know the command */
+int
+accept_overview(n_res)
+  nntp_response *n_res;
+{
+  if (n_res->status == NNTP_UNKNOWN_COMMAND || n_res->status == NNTP_SYNTAX_ERROR) {
+    return -2;
+  }
+  if (n_res->status != NNTP_OVERVIEW_OK) {
+    return -1;
+  }
+  return 0;
+}
+
+/* parse the data of an XZVER/XOVER reply into articles, decompressing it
+ * first if it's XZVER */
+int
+decode_overview(dec, data, len, articles, ar, compressed, low, high, group_id)
+  nntp_decoder *dec;
+  const char *data;
+  size_t len;
+  article *articles;
+  arena *ar;
+  int compressed;
+  long long low;
+  long long high;
+  long long group_id;
+{
+  header_parser p;
+
+  p.articles = articles;
+  p.arena = ar;
+  p.hdr = NULL;
+  p.low = low;
+  p.high = high;
+  p.group_id = group_id;
+  p.update = 0;
+  p.count = 0;
+  p.status = 0;
+
+  if (decode_records(compressed ? dec : NULL, data, len, parse_overview_record, &p) < 0) {
+    fprintf(stderr, "Couldn't decode overview.\n");
+    return -1;
+  }
+
+#ifdef DEBUG
+  fprintf(stderr, "Number of valid overview records for this batch: %d.\n", p.count);
+#endif
+  return p.count;
+}
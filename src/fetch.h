@@ -0,0 +1,41 @@
+#ifndef _FETCH_H
+#define _FETCH_H
+
+#include "conn.h"
+#include "response.h"
+#include "article.h"
+#include "decode.h"
+#include "arena.h"
+
+#define NUM_HEADERS 5
+
+/* overview fields following the article number */
+#define OVERVIEW_SUBJECT 0
+#define OVERVIEW_FROM 1
+#define OVERVIEW_DATE 2
+#define OVERVIEW_MESSAGE_ID 3
+#define OVERVIEW_REFERENCES 4
+#define OVERVIEW_BYTES 5
+#define OVERVIEW_LINES 6
+#define OVERVIEW_FIELDS 7
+
+extern char *headers[];
+
+/* reply data blocks as they came off the wire, to be decoded later */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} fetch_buffer;
+
+int fetch_append(fetch_buffer *, const char *, size_t);
+
+int request_headers(nntp_conn *, int, int, long long, long long);
+int accept_headers(nntp_response *);
+int decode_headers(nntp_decoder *, const char *, size_t, article *, arena *, const char *, long long, long long, long long, int);
+
+int request_overview(nntp_conn *, int, long long, long long);
+int accept_overview(nntp_response *);
+int decode_overview(nntp_decoder *, const char *, size_t, article *, arena *, int, long long, long long, long long);
+
+#endif
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+/* FNV-1a */
+unsigned long
+hash_bytes(key, len)
+  const char *key;
+  size_t len;
+{
+  unsigned long h = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char) key[i];
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+hash *
+hash_new(size)
+  size_t size;
+{
+  hash *h;
+
+  h = (hash *)malloc(sizeof(hash));
+  if (h == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  for (h->size = 16; h->size < size; h->size <<= 1);
+  h->count = 0;
+  h->buckets = (hash_entry **)calloc(h->size, sizeof(hash_entry *));
+  if (h->buckets == NULL) {
+    perror("calloc");
+    free(h);
+    return NULL;
+  }
+  return h;
+}
+
+/* free the table, handing each value to free_value if given */
+void
+hash_free(h, free_value)
+  hash *h;
+  void (*free_value)(void *);
+{
+  hash_entry *e, *next;
+  size_t i;
+
+  for (i = 0; i < h->size; i++) {
+    for (e = h->buckets[i]; e != NULL; e = next) {
+      next = e->next;
+      if (free_value != NULL)
+        free_value(e->value);
+      free(e);
+    }
+  }
+  free(h->buckets);
+  free(h);
+}
+
+static void
+hash_grow(h)
+  hash *h;
+{
+  hash_entry **buckets, *e, *next;
+  size_t i, size = h->size << 1;
+
+  buckets = (hash_entry **)calloc(size, sizeof(hash_entry *));
+  if (buckets == NULL) {
+    /* just stay at this size */
+    return;
+  }
+  for (i = 0; i < h->size; i++) {
+    for (e = h->buckets[i]; e != NULL; e = next) {
+      next = e->next;
+      e->next = buckets[e->hash & (size - 1)];
+      buckets[e->hash & (size - 1)] = e;
+    }
+  }
+  free(h->buckets);
+  h->buckets = buckets;
+  h->size = size;
+}
+
+/* find the value slot for key; if it isn't there and create is set, add
+ * it with a NULL value.  Returns NULL if the key isn't found (or can't be
+ * added). */
+void **
+hash_lookup(h, key, klen, create)
+  hash *h;
+  const char *key;
+  size_t klen;
+  int create;
+{
+  hash_entry *e;
+  unsigned long hv = hash_bytes(key, klen);
+
+  for (e = h->buckets[hv & (h->size - 1)]; e != NULL; e = e->next) {
+    if (e->hash == hv && e->klen == klen && memcmp(e->key, key, klen) == 0)
+      return &e->value;
+  }
+  if (!create)
+    return NULL;
+
+  if (h->count >= h->size)
+    hash_grow(h);
+
+  e = (hash_entry *)malloc(sizeof(hash_entry) + klen + 1);
+  if (e == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  e->hash = hv;
+  e->klen = klen;
+  e->value = NULL;
+  memcpy(e->key, key, klen);
+  e->key[klen] = 0;
+  e->next = h->buckets[hv & (h->size - 1)];
+  h->buckets[hv & (h->size - 1)] = e;
+  h->count++;
+  return &e->value;
+}
+
+void
+hash_each(h, cb, arg)
+  hash *h;
+  void (*cb)(const char *, size_t, void *, void *);
+  void *arg;
+{
+  hash_entry *e;
+  size_t i;
+
+  for (i = 0; i < h->size; i++) {
+    for (e = h->buckets[i]; e != NULL; e = e->next)
+      cb(e->key, e->klen, e->value, arg);
+  }
+}
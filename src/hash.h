@@ -0,0 +1,27 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stddef.h>
+
+typedef struct hash_entry {
+  struct hash_entry *next;
+  unsigned long hash;
+  size_t klen;
+  void *value;
+  char key[];
+} hash_entry;
+
+/* chained hash table of byte-string keys; it grows as it fills up */
+typedef struct {
+  hash_entry **buckets;
+  size_t size;      /* number of buckets, a power of two */
+  size_t count;
+} hash;
+
+unsigned long hash_bytes(const char *, size_t);
+hash *hash_new(size_t);
+void hash_free(hash *, void (*)(void *));
+void **hash_lookup(hash *, const char *, size_t, int);
+void hash_each(hash *, void (*)(const char *, size_t, void *, void *), void *);
+
+#endif
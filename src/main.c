@@ -1,287 +1,165 @@
+#include <signal.h>
+#include <limits.h>
 #include "main.h"
 #include "conn.h"
 #include "group.h"
 #include "response.h"
 #include "database.h"
 #include "article.h"
+#include "session.h"
+#include "crawl.h"
+#include "schedule.h"
+#include "stats.h"
+#include "capture.h"
 
-char *
-nntp_decode_headers(data)
-  const char *data;
-{
-  int ret, len, r_len, r_total;
-  size_t ylen;
-  unsigned have;
-  z_stream strm;
-  unsigned char in[CHUNK];
-  unsigned char out[CHUNK];
-  const char *tail = data;
-  char *r_head, *r_tail;
-
-  /* verify yenc info */
-  ylen = strlen(YENC_LINE);
-  if (strncmp(data, YENC_LINE, ylen) != 0) {
-    fprintf(stderr, "Bad header format: %s\n", data);
-    return NULL;
-  }
-  tail += (int) ylen;
+char timestamp[100];
 
-  /* allocate inflate state */
-  strm.zalloc = Z_NULL;
-  strm.zfree = Z_NULL;
-  strm.opaque = Z_NULL;
-  strm.avail_in = 0;
-  strm.next_in = Z_NULL;
-  ret = inflateInit2(&strm, -15);
-  if (ret != Z_OK) {
-    fprintf(stderr, "inflateInit failed.\n");
-    return NULL;
-  }
+void
+set_timestamp()
+{
+  time_t t;
+  struct tm *tmp;
 
-  r_head = r_tail = (char *)malloc(sizeof(char) * CHUNK);
-  if (r_head == NULL) {
-    (void)inflateEnd(&strm);
-    fprintf(stderr, "Couldn't allocate result data.\n");
-    return NULL;
+  t = time(NULL);
+  if ((tmp = localtime(&t)) == NULL) {
+    fprintf(stderr, "Couldn't get localtime.\n");
+    return;
   }
-  r_total = CHUNK;
-  r_len = 0;
-
-  /* decompress this ish */
-  do {
-    if (tail == 0 || *tail == 0) {
-      /* premature end */
-      (void)inflateEnd(&strm);
-      free(r_head);
-      fprintf(stderr, "Premature end.\n");
-      return NULL;
-    }
-
-    /* fill up the buffer */
-    len = 0;
-    while (len < CHUNK && tail) {
-      if (strncmp("\r\n", tail, 2) == 0) {
-        /* quit if =yend found */
-        tail += 2;
-        if (strncmp("=yend", tail, 5) == 0) {
-          tail = 0;
-          break;
-        }
-      }
-      else {
-        if (*tail != '=') {
-          in[len++] = *tail - 42;
-        }
-        else {
-          switch(*++tail) {
-            default:
-              fprintf(stderr, "Bad escape: \\%o\n", *tail);
-            /*   NUL       TAB        LF        CR */
-            case '@': case 'I': case 'J': case 'M':
-            /*    =         .        ??? */
-            case '}': case 'n': case '`':
-              in[len++] = *tail - '@' - 42;
-              break;
-          }
-        }
-        tail++;
-      }
-    }
-
-    /* inflate! */
-    strm.avail_in = len;
-    strm.next_in = in;
-    do {
-      strm.avail_out = CHUNK;
-      strm.next_out = out;
-      ret = inflate(&strm, Z_NO_FLUSH);
-      assert(ret != Z_STREAM_ERROR);
-      switch (ret) {
-        case Z_NEED_DICT:
-          ret = Z_DATA_ERROR;     /* and fall through */
-        case Z_DATA_ERROR:
-        case Z_MEM_ERROR:
-          (void)inflateEnd(&strm);
-          free(r_head);
-          fprintf(stderr, "Inflate failed: %d\n", ret);
-          return NULL;
-      }
-
-      have = CHUNK - strm.avail_out;
-      if (have + r_len >= r_total) {
-        r_total += CHUNK;
-        r_head = (char *)realloc((void *)r_head, r_total);
-        if (r_head == NULL) {
-          (void)inflateEnd(&strm);
-          fprintf(stderr, "Couldn't reallocate result data.\n");
-          return NULL;
-        }
-        r_tail = r_head + r_len;
-      }
-      strncpy(r_tail, (const char *) out, have);
-      r_len += have;
-      r_tail += have;
-    } while (strm.avail_out == 0);
-
-    /* done when inflate() says it's done */
-  } while (ret != Z_STREAM_END);
-
-  /* clean up and return */
-  (void)inflateEnd(&strm);
-  if (ret == Z_STREAM_END) {
-    *r_tail = 0;
-    return r_head;
+  if (strftime(timestamp, 100, "%a, %d %b %Y %H:%M:%S %z", tmp) == 0) {
+    fprintf(stderr, "Couldn't strftime.\n");
   }
-
-  free(r_head);
-  fprintf(stderr, "Data error.\n");
-  return NULL;
 }
 
-void
-nntp_init()
-{
-  SSL_library_init();
-  SSL_load_error_strings();
-  ERR_load_BIO_strings();
-  OpenSSL_add_all_algorithms();
-}
+static volatile sig_atomic_t stopping = 0;
 
-void
-nntp_shutdown(n_conn, n_res)
-  nntp_conn *n_conn;
-  nntp_response *n_res;
+static void
+stop(sig)
+  int sig;
 {
-  if (n_res != NULL)
-    nntp_response_free(n_res);
-
-  nntp_send(n_conn, "QUIT\r\n");
-  n_res = nntp_receive(n_conn);
-  nntp_response_free(n_res);
-
-  if (n_conn != NULL)
-    nntp_conn_free(n_conn);
+  stopping = 1;
 }
 
-int
-process_headers(n_conn, db, articles, hdr, low, high, group_id, update)
-  nntp_conn *n_conn;
+/* fetch a group up to its high mark, and the next BACKFILL_CHUNK of its
+ * history below what we have; next and first end up at the articles
+ * written, even if the crawl didn't get that far */
+static int
+fetch_group(cr, db, g, log)
+  crawl *cr;
   database *db;
-  article *articles;
-  const char *hdr;
-  long long low;
-  long long high;
-  long long group_id;
-  int update;
+  schedule_group *g;
+  FILE *log;
 {
-  int count = 0, len;
-  long long article_id;
-  char tmp[1024], *headers, *h_cur, *h_tail;
-  nntp_response *n_res;
+  long long article_id, back_low, back_high;
 
-  sprintf(tmp, "XZHDR %s %lld-%lld\r\n", hdr, low, high);
-  nntp_send(n_conn, tmp);
-  n_res = nntp_receive(n_conn);
-  if (n_res->status == NNTP_XZHDR_OK) {
-    headers = nntp_decode_headers((char *)n_res->data);
+  back_high = g->first - 1;
+  back_low = g->history > BACKFILL_CHUNK ? g->first - BACKFILL_CHUNK : g->first - g->history;
+  if (log != NULL) {
+    set_timestamp();
+    if (g->backlog > 0)
+      fprintf(log, "%s: Group %s: %lld - %lld (%lld articles)\n", timestamp, g->name, g->next, g->high, g->backlog);
+    if (g->history > 0)
+      fprintf(log, "%s: Group %s: backfilling %lld - %lld (%lld articles left)\n", timestamp, g->name,
+          back_low, back_high, g->history);
+    fflush(log);
   }
-  else {
-    headers = NULL;
+  if (crawl_run(cr, db, g->name, g->group_id, g->next, g->high, back_low, back_high, log) == 0) {
+    g->next = g->high + 1;
+    g->backlog = 0;
+    g->history -= g->first - back_low;
+    g->first = back_low;
+    return 0;
   }
-  free(n_res->data);
-  nntp_response_free(n_res);
-
-  if (headers == NULL) {
-    fprintf(stderr, "Couldn't fetch headers.\n");
-    return -1;
+  fprintf(stderr, "Couldn't crawl %s; moving on.\n", g->name);
+  if ((article_id = database_last_article_id_for_group(db, g->group_id)) >= g->next) {
+    g->next = article_id + 1;
+    g->backlog = g->high - g->next + 1;
   }
-#ifdef DEBUG
-  /*
-  strncpy(tmp, headers, 128);
-  tmp[128] = 0;
-  fprintf(stderr, "First bit of headers: %s\n", tmp);
-  */
-#endif
-
-  /* insert headers into database */
-  h_tail = h_cur = headers;
-  while (*h_cur != 0) {
-    h_tail = strstr(h_cur, "\r\n");
-    if (h_tail == NULL) {
-      fprintf(stderr, "Invalid header record found.\n");
-      break;
-    }
-
-    article_id = strtoll(h_cur, &h_cur, 10);
-    if (article_id == 0) {
-      fprintf(stderr, "Invalid article id.\n");
-      break;
-    }
+  if ((article_id = database_first_article_id_for_group(db, g->group_id)) > 0 && article_id < g->first) {
+    g->history -= g->first - article_id;
+    g->first = article_id;
+  }
+  return 1;
+}
 
-    while (*h_cur == ' ')
-      h_cur++;
+/* refetch a group's gaps that the server still has, a few at a time:
+ * gaps less than slack articles apart go in one range, since asking for
+ * the articles between them again costs less than another command */
+static int
+repair_group(cr, db, g, slack, log)
+  crawl *cr;
+  database *db;
+  schedule_group *g;
+  long long slack;
+  FILE *log;
+{
+  database_gap *gaps;
+  long long low, high;
+  int i, n, res = 0;
 
-    if (update == 0) {
-      articles[count].article_id = article_id;
-      articles[count].group_id = group_id;
+  if ((n = database_gaps_for_group(db, g->group_id, &gaps)) < 0)
+    return 1;
+  for (i = 0; i < n && res == 0; ) {
+    if (gaps[i].high < g->low) {
+      i++;
+      continue;
     }
-    else if (articles[count].article_id != article_id) {
-      fprintf(stderr, "Article doesn't match.\n");
-      break;
+    low = gaps[i].low < g->low ? g->low : gaps[i].low;
+    high = gaps[i].high;
+    for (i++; i < n && gaps[i].low <= high + slack; i++) {
+      if (gaps[i].high > high)
+        high = gaps[i].high;
     }
+    if (high > g->high)
+      high = g->high;
+    if (low > high)
+      continue;
 
-    len = h_tail - h_cur;
-    if (strcmp(hdr, "Subject") == 0) {
-      articles[count].subject = (char *)malloc(sizeof(char) * len);
-      strncpy(articles[count].subject, h_cur, len);
-      articles[count].slen = len;
-    }
-    else if (strcmp(hdr, "Message-ID") == 0) {
-      articles[count].message_id = (char *)malloc(sizeof(char) * len);
-      strncpy(articles[count].message_id, h_cur, len);
-      articles[count].mlen = len;
-    }
-    else if (strcmp(hdr, "From") == 0) {
-      articles[count].poster = (char *)malloc(sizeof(char) * len);
-      strncpy(articles[count].poster, h_cur, len);
-      articles[count].plen = len;
-    }
-    else if (strcmp(hdr, "Date") == 0) {
-      articles[count].posted_at = (char *)malloc(sizeof(char) * len);
-      strncpy(articles[count].posted_at, h_cur, len);
-      articles[count].wlen = len;
-    }
-    else if (strcmp(hdr, "Bytes") == 0) {
-      articles[count].bytes = strtoll(h_cur, NULL, 10);
+    if (log != NULL) {
+      set_timestamp();
+      fprintf(log, "%s: Group %s: repairing %lld - %lld\n", timestamp, g->name, low, high);
+      fflush(log);
     }
-
-    h_cur = h_tail + 2;
-    count++;
+    if ((res = crawl_run(cr, db, g->name, g->group_id, low, high, 1, 0, log)) != 0)
+      fprintf(stderr, "Couldn't repair %s; moving on.\n", g->name);
   }
-  free(headers);
-
-#ifdef DEBUG
-  fprintf(stderr, "Number of valid headers for this batch: %d.\n", count);
-#endif
-  return count;
+  free(gaps);
+  return res;
 }
 
-static char timestamp[100];
-
-void
-set_timestamp()
+/* rewrite the metrics file, at most every STATS_INTERVAL seconds unless
+ * forced */
+static void
+write_metrics(filename, force)
+  const char *filename;
+  int force;
 {
-  time_t t;
-  struct tm *tmp;
+  static time_t written = 0;
+  time_t now = time(NULL);
 
-  t = time(NULL);
-  if ((tmp = localtime(&t)) == NULL) {
-    fprintf(stderr, "Couldn't get localtime.\n");
+  if (filename == NULL || (!force && now - written < STATS_INTERVAL))
     return;
-  }
-  if (strftime(timestamp, 100, "%a, %d %b %Y %H:%M:%S %z", tmp) == 0) {
-    fprintf(stderr, "Couldn't strftime.\n");
-  }
+  stats_write_prometheus(filename);
+  written = now;
+}
+
+/* feed a capture's replies through decoding and the inserts, with no
+ * server at all */
+static int
+replay(db, dir, batch_min, batch_max, log)
+  database *db;
+  const char *dir;
+  long long batch_min;
+  long long batch_max;
+  FILE *log;
+{
+  crawl *cr;
+  int res;
+
+  if ((cr = crawl_new(NULL, NULL, NULL, NULL, 1, 0, 0, batch_min, batch_max)) == NULL)
+    return 1;
+  res = crawl_replay(cr, db, dir, log);
+  crawl_free(cr);
+  return res;
 }
 
 void
@@ -292,9 +170,28 @@ print_syntax(name)
   printf("  -s, --server SERVER\n");
   printf("  -u, --user USER\n");
   printf("  -p, --password PASSWORD\n");
-  printf("  -g, --group GROUP\n");
+  printf("  -A, --ca-file FILE        (trust the certificates in FILE instead of the system's)\n");
+  printf("  -g, --group GROUP[,GROUP...] (may be repeated)\n");
+  printf("  -G, --group-file FILE     (groups to crawl, one per line)\n");
+  printf("  -w, --wildmat PATTERN     (crawl every group the server lists for PATTERN)\n");
   printf("  -d, --database DATABASE   (default: pwnntp.sqlite3)\n");
   printf("  -l, --log FILE\n");
+  printf("  -P, --pipeline DEPTH      (article ranges to request ahead; default: 0)\n");
+  printf("  -c, --connections N       (sessions to fetch with; default: 1)\n");
+  printf("  -b, --batch MIN[:MAX]     (bounds on articles per range; default: %d:%d)\n", BATCH_MIN, BATCH_MAX);
+  printf("  -o, --overview            (fetch XZVER/XOVER instead of XZHDR per field)\n");
+  printf("  -W, --wal                 (put the database in WAL mode)\n");
+  printf("  -S, --synchronous MODE    (OFF, NORMAL or FULL; default: sqlite's)\n");
+  printf("  -C, --cache-size N        (sqlite cache_size pragma; negative is KiB)\n");
+  printf("  -D, --no-date-text        (store dates only as epoch seconds, not as posted)\n");
+  printf("  -F, --daemon              (keep running, polling the groups for new articles)\n");
+  printf("  -B, --backfill            (crawl new groups newest first, then back through their history)\n");
+  printf("  -r, --repair              (refetch only the articles the groups are missing)\n");
+  printf("  -I, --poll-interval SECS  (shortest time between polls of a group; default: %d)\n", POLL_MIN);
+  printf("  -J, --stats FILE          (write timings and counters as JSON at exit; - is stdout)\n");
+  printf("  -M, --metrics FILE        (keep a Prometheus text file of them up to date)\n");
+  printf("  -K, --capture DIR         (keep the server's raw replies in DIR)\n");
+  printf("  -R, --replay DIR          (insert the replies captured in DIR instead of crawling)\n");
 }
 
 int
@@ -302,19 +199,26 @@ main(argc, argv)
   int argc;
   char *argv[];
 {
-  int j, c, count = 0, res = 0;
-  long long i, article_id, group_id, group_low, group_high, upper, lower;
-  char cmd[1024], *hdr;
+  int c, i, res = 0, pipeline = 0, connections = 1, overview = 0, wal = 0, cache_size = 0, date_text = 1,
+      daemon = 0, repair = 0, poll_min = POLL_MIN;
+  long long batch_min = BATCH_MIN, batch_max = BATCH_MAX;
+  long long low, high;
+  time_t now;
   FILE *log = NULL;
   nntp_conn *n_conn = NULL;
-  nntp_response *n_res = NULL;
-  nntp_group *n_group = NULL;
   database *db = NULL;
-  article articles[LIMIT];
+  crawl *cr = NULL;
+  schedule *sched = NULL;
+  schedule_group *g, *b;
 
   /* parse options */
-  char *server = NULL, *user = NULL, *password = NULL, *group = NULL,
-       *db_filename = DEFAULT_DATABASE, *logfile = NULL;
+  char *server = NULL, *user = NULL, *password = NULL, *groups = NULL, *group_file = NULL,
+       *wildmat = NULL, *db_filename = DEFAULT_DATABASE, *logfile = NULL, *synchronous = NULL,
+       *stats_file = NULL, *metrics_file = NULL, *ca_file = NULL, *capture_dir = NULL, *replay_dir = NULL;
+  capture *cap = NULL;
+
+  if ((sched = schedule_new()) == NULL)
+    return 1;
 
   while (1)
   {
@@ -323,14 +227,33 @@ main(argc, argv)
       {"server"  , required_argument, 0, 's'},
       {"user"    , required_argument, 0, 'u'},
       {"password", required_argument, 0, 'p'},
+      {"ca-file" , required_argument, 0, 'A'},
       {"group"   , required_argument, 0, 'g'},
+      {"group-file", required_argument, 0, 'G'},
+      {"wildmat" , required_argument, 0, 'w'},
       {"database", required_argument, 0, 'd'},
       {"log",      required_argument, 0, 'l'},
+      {"pipeline", required_argument, 0, 'P'},
+      {"connections", required_argument, 0, 'c'},
+      {"batch", required_argument, 0, 'b'},
+      {"overview", no_argument, 0, 'o'},
+      {"wal", no_argument, 0, 'W'},
+      {"synchronous", required_argument, 0, 'S'},
+      {"cache-size", required_argument, 0, 'C'},
+      {"no-date-text", no_argument, 0, 'D'},
+      {"daemon", no_argument, 0, 'F'},
+      {"backfill", no_argument, 0, 'B'},
+      {"repair", no_argument, 0, 'r'},
+      {"poll-interval", required_argument, 0, 'I'},
+      {"stats", required_argument, 0, 'J'},
+      {"metrics", required_argument, 0, 'M'},
+      {"capture", required_argument, 0, 'K'},
+      {"replay", required_argument, 0, 'R'},
       {0, 0, 0, 0}
     };
     /* getopt_long stores the option index here. */
     int option_index = 0;
-    c = getopt_long (argc, argv, "s:u:p:g:d:l:", long_options, &option_index);
+    c = getopt_long (argc, argv, "s:u:p:A:g:G:w:d:l:P:c:b:oWS:C:DFBrI:J:M:K:R:", long_options, &option_index);
 
     /* Detect the end of the options. */
     if (c == -1)
@@ -351,8 +274,21 @@ main(argc, argv)
       case 'p':
         password = optarg;
         break;
+      case 'A':
+        ca_file = optarg;
+        break;
       case 'g':
-        group = optarg;
+        if (schedule_add_list(sched, optarg) != 0)
+          return 1;
+        groups = optarg;
+        break;
+      case 'G':
+        if (schedule_add_file(sched, optarg) != 0)
+          return 1;
+        group_file = optarg;
+        break;
+      case 'w':
+        wildmat = optarg;
         break;
       case 'd':
         db_filename = optarg;
@@ -360,6 +296,57 @@ main(argc, argv)
       case 'l':
         logfile = optarg;
         break;
+      case 'P':
+        pipeline = atoi(optarg);
+        break;
+      case 'c':
+        connections = atoi(optarg);
+        break;
+      case 'b':
+        if (sscanf(optarg, "%lld:%lld", &batch_min, &batch_max) < 1) {
+          print_syntax(argv[0]);
+          return 1;
+        }
+        break;
+      case 'o':
+        overview = 1;
+        break;
+      case 'W':
+        wal = 1;
+        break;
+      case 'S':
+        synchronous = optarg;
+        break;
+      case 'C':
+        cache_size = atoi(optarg);
+        break;
+      case 'D':
+        date_text = 0;
+        break;
+      case 'F':
+        daemon = 1;
+        break;
+      case 'B':
+        sched->backfill = 1;
+        break;
+      case 'r':
+        repair = 1;
+        break;
+      case 'I':
+        poll_min = atoi(optarg);
+        break;
+      case 'J':
+        stats_file = optarg;
+        break;
+      case 'M':
+        metrics_file = optarg;
+        break;
+      case 'K':
+        capture_dir = optarg;
+        break;
+      case 'R':
+        replay_dir = optarg;
+        break;
       case '?':
         /* getopt_long already printed an error message. */
         break;
@@ -368,166 +355,183 @@ main(argc, argv)
         return(1);
     }
   }
-  if (server == NULL || user == NULL || password == NULL || group == NULL) {
+  if (replay_dir != NULL) {
+    if (batch_min < 1 || batch_max < batch_min || batch_max > INT_MAX || capture_dir != NULL || daemon) {
+      print_syntax(argv[0]);
+      schedule_free(sched);
+      return 1;
+    }
+    schedule_free(sched);
+    if (logfile != NULL && (log = fopen(logfile, "a")) == NULL) {
+      fprintf(stderr, "Couldn't open logfile %s.\n", logfile);
+      return 1;
+    }
+    if (log != NULL) {
+      set_timestamp();
+      fprintf(log, "%s: Started pwnntp, replaying %s\n", timestamp, replay_dir);
+      fflush(log);
+    }
+    stats_start();
+    if ((db = database_open(sqlite, db_filename)) == NULL ||
+        database_configure(db, wal, synchronous, cache_size, date_text) > 0) {
+      res = 1;
+    }
+    else {
+      res = replay(db, replay_dir, batch_min, batch_max, log);
+    }
+    write_metrics(metrics_file, 1);
+    if (stats_file != NULL)
+      stats_write_json(stats_file);
+    if (log != NULL) {
+      set_timestamp();
+      fprintf(log, "%s: pwnntp finished\n", timestamp);
+      fclose(log);
+    }
+    if (db != NULL)
+      database_close(db);
+    return res;
+  }
+  if (server == NULL || user == NULL || password == NULL || connections < 1 || poll_min < 1 ||
+      batch_min < 1 || batch_max < batch_min || batch_max > INT_MAX || (repair && daemon) ||
+      (groups == NULL && group_file == NULL && wildmat == NULL)) {
     print_syntax(argv[0]);
+    schedule_free(sched);
     return 1;
   }
   if (logfile != NULL) {
     log = fopen(logfile, "a");
     if (log == NULL) {
       fprintf(stderr, "Couldn't open logfile %s.\n", logfile);
+      schedule_free(sched);
       return 1;
     }
     set_timestamp();
     fprintf(log, "%s: Started pwnntp\n", timestamp);
-    fprintf(log, "%s:   Server: %s, User: %s, Group: %s\n", timestamp, server, user, group);
+    fprintf(log, "%s:   Server: %s, User: %s, Groups: %d%s%s\n", timestamp, server, user,
+        sched->count, wildmat != NULL ? ", Wildmat: " : "", wildmat != NULL ? wildmat : "");
     fflush(log);
   }
 
-  nntp_init();
-  if ((n_conn = nntp_conn_new(server)) == NULL) {
-    return 1;
-  }
-  if ((n_res = nntp_receive(n_conn)) == NULL) {
-    nntp_conn_free(n_conn);
-    return 1;
-  }
-  if (n_res->status != NNTP_OK) {
-    fprintf(stderr, "Status wasn't OK.\n");
-    if (log != NULL)
-      fclose(log);
-    nntp_shutdown(n_conn, n_res);
-    return 1;
-  }
-  nntp_response_free(n_res); n_res = NULL;
-
-  /* authentication */
-  sprintf(cmd, "AUTHINFO USER %s\r\n", user);
-  nntp_send(n_conn, cmd);
-  n_res = nntp_receive(n_conn);
-  if (n_res->status == NNTP_PASS_REQUIRED) {
-    sprintf(cmd, "AUTHINFO PASS %s\r\n", password);
-    nntp_send(n_conn, cmd);
-  }
-  nntp_response_free(n_res); n_res = NULL;
-  n_res = nntp_receive(n_conn);
-  if (n_res->status != NNTP_AUTH_OK) {
-    fprintf(stderr, "Authentication was unsuccessful.\n");
-    if (log != NULL)
-      fclose(log);
-    nntp_shutdown(n_conn, n_res);
-    return 1;
-  }
-  nntp_response_free(n_res); n_res = NULL;
-
-  /* group selection */
-  sprintf(cmd, "GROUP %s\r\n", group);
-  nntp_send(n_conn, cmd);
-  n_res = nntp_receive(n_conn);
-  if (n_res->status == NNTP_GROUP_OK) {
-    n_group = (nntp_group *)n_res->data;
-    group_low = n_group->low;
-    group_high = n_group->high;
-    nntp_group_free(n_group);
-  }
-  else {
+  stats_start();
+  /* a dropped connection shouldn't take the process with it; the session
+   * reconnects instead */
+  signal(SIGPIPE, SIG_IGN);
+  nntp_init(ca_file);
+  if ((n_conn = nntp_login(server, user, password)) == NULL) {
     if (log != NULL)
       fclose(log);
-    nntp_shutdown(n_conn, n_res);
-    fprintf(stderr, "Group command wasn't successful.\n");
+    schedule_free(sched);
     return 1;
   }
-  nntp_response_free(n_res); n_res = NULL;
 
   /* database setup */
   db = database_open(sqlite, db_filename);
   if (!db) {
     if (log != NULL)
       fclose(log);
-    nntp_shutdown(n_conn, n_res);
-    return 1;
-  }
-  group_id = database_find_or_create_group(db, group);
-  if (group_id < 0) {
-    if (log != NULL)
-      fclose(log);
-    database_close(db);
-    nntp_shutdown(n_conn, n_res);
+    nntp_shutdown(n_conn, NULL);
+    schedule_free(sched);
     return 1;
   }
-  article_id = database_last_article_id_for_group(db, group_id);
-  if (article_id < 0) {
+  if (database_configure(db, wal, synchronous, cache_size, date_text) > 0 ||
+      (wildmat != NULL && schedule_add_active(sched, n_conn, wildmat) != 0) ||
+      schedule_prepare(sched, n_conn, db) != 0) {
     if (log != NULL)
       fclose(log);
     database_close(db);
-    nntp_shutdown(n_conn, n_res);
+    nntp_shutdown(n_conn, NULL);
+    schedule_free(sched);
     return 1;
   }
-  if (article_id >= group_high) {
+  if (!daemon && !repair && (sched->count == 0 || sched->groups[0].backlog == 0) && schedule_backfill(sched) == NULL) {
     if (log != NULL) {
       set_timestamp();
       fprintf(log, "%s: No articles to fetch.\n", timestamp);
       fclose(log);
     }
     database_close(db);
-    nntp_shutdown(n_conn, n_res);
+    nntp_shutdown(n_conn, NULL);
+    schedule_free(sched);
     return 0;
   }
 
-  /* grab the headers! */
-  i = article_id == 0 ? group_low : article_id + 1;
-  while (i < group_high) {
-    lower = i; upper = i + LIMIT - 1;
-    if (upper > group_high)
-      upper = group_high;
-
-    if (log != NULL) {
-      set_timestamp();
-      fprintf(log, "%s: Headers %lld - %lld\n", timestamp, lower, upper);
-      fflush(log);
-    }
-
-    for (j = 0, hdr = headers[0]; hdr != NULL; hdr = headers[++j]) {
-      count = process_headers(n_conn, db, articles, hdr, lower, upper, group_id, j);
-      if (count < 0) {
-        fprintf(stderr, "No headers!\n");
-        if (log != NULL)
-          fclose(log);
-        database_close(db);
-        nntp_shutdown(n_conn, n_res);
-        return 1;
-      }
-    }
+  /* grab the headers, the groups furthest behind first */
+  cr = crawl_new(server, user, password, n_conn, connections, pipeline, overview, batch_min, batch_max);
+  if (cr != NULL && capture_dir != NULL && (cr->capture = cap = capture_open(capture_dir)) == NULL) {
+    crawl_free(cr);
+    cr = NULL;
+    n_conn = NULL;
+  }
+  if (cr == NULL) {
+    if (log != NULL)
+      fclose(log);
+    database_close(db);
+    nntp_shutdown(n_conn, NULL);
+    schedule_free(sched);
+    return 1;
+  }
+  if (daemon) {
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+  }
+  /* a repair refetches the gaps and nothing else */
+  cr->repairing = repair;
+  for (i = 0; repair && i < sched->count && !stopping; i++) {
+    if (repair_group(cr, db, &sched->groups[i], batch_min, log) != 0)
+      res = 1;
+    write_metrics(metrics_file, 0);
+  }
+  for (i = 0; !repair && i < sched->count && !stopping; i++) {
+    g = &sched->groups[i];
+    if ((g->backlog > 0 || g->history > 0) && fetch_group(cr, db, g, log) != 0)
+      res = 1;
+    write_metrics(metrics_file, 0);
+  }
 
-    /* insert articles */
-    article_id = 0;
-    if (database_begin(db) > 0) {
+  /* then the rest of the backfill, the group with the most left first */
+  while (!daemon && !repair && !stopping && (g = schedule_backfill(sched)) != NULL) {
+    if (fetch_group(cr, db, g, log) != 0) {
+      res = 1;
       break;
     }
-    for (j = 0; j < count; j++) {
-      if (j == 0 || res > 0) {
-        res = database_insert_article(db, &articles[j]);
-        free(articles[j].subject);
-        free(articles[j].message_id);
-        free(articles[j].poster);
-        free(articles[j].posted_at);
-        if (res > 0) {
-          article_id = articles[j].article_id;
-        }
-      }
-    }
-    if (article_id > 0) {
-      database_group_set_last_article_id(db, group_id, article_id);
+    write_metrics(metrics_file, 0);
+  }
+
+  /* then keep polling each group for its new high mark, and fetch just
+   * what's new; sessions stay logged in, or log in again if dropped */
+  if (daemon && sched->count > 0) {
+    schedule_start(sched, poll_min, POLL_MAX);
+    res = 0;
+  }
+  while (daemon && sched->count > 0 && !stopping) {
+    g = schedule_due(sched);
+    now = time(NULL);
+    if (g->poll_at > now) {
+      /* backfill while there's nothing to poll, if there's any left */
+      if ((b = schedule_backfill(sched)) == NULL || fetch_group(cr, db, b, log) != 0)
+        sleep((unsigned int)(g->poll_at - now));
+      write_metrics(metrics_file, 0);
+      continue;
     }
-    if (database_commit(db) > 0) {
-      break;
+    if (crawl_poll(cr, g->name, &low, &high) != 0) {
+      fprintf(stderr, "Couldn't poll %s.\n", g->name);
+      low = g->low;
+      high = g->high;
     }
-
-    i += LIMIT;
-#ifdef DEBUG
-    fprintf(stderr, "======================\n");
-#endif
+    if (low > g->next && g->next <= g->high)
+      database_add_gap(db, g->group_id, g->next, low - 1 < g->high ? low - 1 : g->high, "expired");
+    schedule_update(sched, g, low, high);
+    if (g->backlog > 0)
+      fetch_group(cr, db, g, log);
+    write_metrics(metrics_file, 0);
   }
+  crawl_free(cr);
+  if (cap != NULL)
+    capture_close(cap);
+  schedule_free(sched);
+  write_metrics(metrics_file, 1);
+  if (stats_file != NULL)
+    stats_write_json(stats_file);
 
   if (log != NULL) {
     set_timestamp();
@@ -535,6 +539,5 @@ main(argc, argv)
     fclose(log);
   }
   database_close(db);
-  nntp_shutdown(n_conn, n_res);
-  return 0;
+  return res;
 }
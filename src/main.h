@@ -10,13 +10,12 @@
 #include <getopt.h>
 #include <time.h>
 
+/* articles per range to start with; crawl adapts it from there */
 #define LIMIT 10000
 #define CHUNK 262144
 #define DEFAULT_DATABASE "pwnntp.sqlite3"
 #define YENC_LINE "=ybegin line=128 size=-1\r\n"
 
-char *headers[] = {
-  "Subject", "Message-ID",
-  "From", "Date", "Bytes",
-  NULL
-};
+extern char timestamp[];
+void set_timestamp();
+
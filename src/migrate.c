@@ -0,0 +1,430 @@
+#include "sqlite.h"
+#include "date.h"
+#include "subject.h"
+
+/* rows copied per transaction when a table is rebuilt */
+#define MIGRATE_ROWS 10000
+
+#define ARTICLES_TABLE \
+  "(id INTEGER PRIMARY KEY, group_id INTEGER, article_id INTEGER, subject TEXT, message_id TEXT, " \
+  "poster_id INTEGER, posted_at TEXT, posted INTEGER, bytes INTEGER, file_id INTEGER, part INTEGER)"
+
+#define ARTICLES_INDEXES \
+  "CREATE UNIQUE INDEX articles_message_id ON articles (message_id);" \
+  "CREATE INDEX articles_file_id ON articles (file_id, part);" \
+  "CREATE INDEX articles_posted ON articles (group_id, posted);" \
+  "CREATE TRIGGER articles_postings AFTER INSERT ON articles BEGIN " \
+    "INSERT OR IGNORE INTO postings VALUES (new.group_id, new.article_id, new.id); END;"
+
+#define POSTINGS_INDEXES \
+  "CREATE INDEX postings_article ON postings (article);"
+
+#define GAPS_TABLE \
+  "CREATE TABLE gaps (group_id INTEGER, low INTEGER, high INTEGER, reason TEXT, PRIMARY KEY (group_id, low)) WITHOUT ROWID;"
+
+/* run a query and tell whether it found anything: 1 if so, 0 if not, -1
+ * on failure */
+static int
+migrate_exists(db, sql)
+  database *db;
+  const char *sql;
+{
+  int res;
+  sqlite3_stmt *stmt;
+
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db, sql, -1, &stmt, NULL);
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return -1;
+  }
+  res = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_ROW && res != SQLITE_DONE) {
+    fprintf(stderr, "Couldn't read schema: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return -1;
+  }
+  return res == SQLITE_ROW;
+}
+
+static int
+migrate_exec(db, sql, what)
+  database *db;
+  const char *sql;
+  const char *what;
+{
+  if (sqlite3_exec((sqlite3 *)db->s_db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Couldn't %s: %s\n", what, sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_exec((sqlite3 *)db->s_db, "ROLLBACK", NULL, NULL, NULL);
+    return 1;
+  }
+  return 0;
+}
+
+/* Databases from before user_version was kept may have had some of the
+ * early migrations already, so those check for what they add first. */
+
+/* SQL function splitting a "name (part/total)" subject: the name, part
+ * or total, as its user data is 0, 1 or 2; NULL if it has no counter */
+static void
+migrate_subject(ctx, argc, argv)
+  sqlite3_context *ctx;
+  int argc;
+  sqlite3_value **argv;
+{
+  int nlen, part, total, field = (int)(long)sqlite3_user_data(ctx);
+  const char *s = (const char *)sqlite3_value_text(argv[0]);
+
+  if (s == NULL || !subject_parse(s, sqlite3_value_bytes(argv[0]), &nlen, &part, &total))
+    sqlite3_result_null(ctx);
+  else if (field == 0)
+    sqlite3_result_text(ctx, s, nlen, SQLITE_TRANSIENT);
+  else
+    sqlite3_result_int(ctx, field == 1 ? part : total);
+}
+
+/* 1: files assembled from "name (part/total)" subjects, and the columns
+ * linking articles to them, filled in for the articles already there */
+static int
+migrate_files(db)
+  database *db;
+{
+  static const char *names[] = { "pwnntp_subject_name", "pwnntp_subject_part", "pwnntp_subject_total" };
+  int res, i;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM sqlite_master WHERE name = 'files'")) != 0)
+    return res < 0;
+
+  for (i = 0; i < 3; i++) {
+    if (sqlite3_create_function((sqlite3 *)db->s_db, names[i], 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, (void *)(long)i, migrate_subject, NULL, NULL) != SQLITE_OK) {
+      fprintf(stderr, "Couldn't add files: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      return 1;
+    }
+  }
+  return migrate_exec(db,
+      "BEGIN;"
+      "CREATE TABLE files (id INTEGER PRIMARY KEY, group_id INTEGER, name TEXT, total_parts INTEGER, parts INTEGER, bytes INTEGER);"
+      "CREATE UNIQUE INDEX files_name ON files (group_id, name, total_parts);"
+      "ALTER TABLE articles ADD COLUMN file_id INTEGER;"
+      "ALTER TABLE articles ADD COLUMN part INTEGER;"
+      "INSERT INTO files (group_id, name, total_parts, parts, bytes) "
+        "SELECT group_id, pwnntp_subject_name(subject) AS name, pwnntp_subject_total(subject) AS total, count(*), coalesce(sum(bytes), 0) "
+        "FROM articles WHERE name IS NOT NULL GROUP BY group_id, name, total;"
+      "UPDATE articles SET part = pwnntp_subject_part(subject), file_id = (SELECT id FROM files "
+        "WHERE files.group_id = articles.group_id AND files.name = pwnntp_subject_name(articles.subject) "
+        "AND files.total_parts = pwnntp_subject_total(articles.subject)) "
+        "WHERE pwnntp_subject_name(subject) IS NOT NULL;"
+      "CREATE INDEX articles_file_id ON articles (file_id, part);"
+      "COMMIT;", "create files table");
+}
+
+/* SQL function reading a Date header into an epoch, NULL if it can't */
+static void
+migrate_date(ctx, argc, argv)
+  sqlite3_context *ctx;
+  int argc;
+  sqlite3_value **argv;
+{
+  long long t;
+  const char *s = (const char *)sqlite3_value_text(argv[0]);
+
+  if (s != NULL && date_parse(s, sqlite3_value_bytes(argv[0]), &t))
+    sqlite3_result_int64(ctx, t);
+  else
+    sqlite3_result_null(ctx);
+}
+
+/* 2: posted_at as seconds since the epoch, indexed per group for age
+ * queries, filled in from posted_at */
+static int
+migrate_dates(db)
+  database *db;
+{
+  int res;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM pragma_table_info('articles') WHERE name = 'posted'")) != 0)
+    return res < 0;
+
+  if (sqlite3_create_function((sqlite3 *)db->s_db, "pwnntp_date", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, migrate_date, NULL, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Couldn't add dates: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return 1;
+  }
+  return migrate_exec(db,
+      "BEGIN;"
+      "ALTER TABLE articles ADD COLUMN posted INTEGER;"
+      "UPDATE articles SET posted = pwnntp_date(posted_at);"
+      "CREATE INDEX articles_posted ON articles (group_id, posted);"
+      "COMMIT;", "add dates");
+}
+
+/* 3: one article row per Message-ID, and a postings table mapping each
+ * group's article numbers to it; crossposted duplicates are folded into
+ * the first copy.  Rows without a Message-ID can't be told apart, so each
+ * keeps its own posting, and an empty one becomes NULL to stay out of the
+ * unique index. */
+static int
+migrate_postings(db)
+  database *db;
+{
+  int res;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM sqlite_master WHERE name = 'postings'")) != 0)
+    return res < 0;
+
+  return migrate_exec(db,
+      "BEGIN;"
+      "CREATE TABLE postings (group_id INTEGER, article_id INTEGER, article INTEGER, PRIMARY KEY (group_id, article_id)) WITHOUT ROWID;"
+      "INSERT OR IGNORE INTO postings SELECT a.group_id, a.article_id, coalesce(c.id, a.id) FROM articles a "
+        "LEFT JOIN (SELECT message_id, min(id) AS id FROM articles WHERE message_id <> '' GROUP BY message_id) c "
+        "ON c.message_id = a.message_id;"
+      "DELETE FROM articles WHERE message_id <> '' AND id NOT IN "
+        "(SELECT min(id) FROM articles WHERE message_id <> '' GROUP BY message_id);"
+      "UPDATE articles SET message_id = NULL WHERE message_id = '';"
+      "UPDATE files SET parts = (SELECT count(*) FROM articles WHERE file_id = files.id), "
+        "bytes = (SELECT coalesce(sum(bytes), 0) FROM articles WHERE file_id = files.id);"
+      "DELETE FROM files WHERE parts = 0;"
+      "CREATE UNIQUE INDEX articles_message_id ON articles (message_id);"
+      "CREATE TRIGGER articles_postings AFTER INSERT ON articles BEGIN "
+        "INSERT OR IGNORE INTO postings VALUES (new.group_id, new.article_id, new.id); END;"
+      "COMMIT;", "add postings");
+}
+
+/* copy the articles with ids in (low, high] to articles_new, interning
+ * their posters on the way */
+static int
+migrate_posters_batch(db, copy_posters, copy_articles, low, high)
+  database *db;
+  sqlite3_stmt *copy_posters;
+  sqlite3_stmt *copy_articles;
+  long long low;
+  long long high;
+{
+  int res;
+
+  if (database_sqlite_begin(db) > 0)
+    return 1;
+  sqlite3_bind_int64(copy_posters, 1, low);
+  sqlite3_bind_int64(copy_posters, 2, high);
+  sqlite3_bind_int64(copy_articles, 1, low);
+  sqlite3_bind_int64(copy_articles, 2, high);
+  res = sqlite3_step(copy_posters);
+  if (res == SQLITE_DONE)
+    res = sqlite3_step(copy_articles);
+  sqlite3_reset(copy_posters);
+  sqlite3_reset(copy_articles);
+  if (res != SQLITE_DONE) {
+    fprintf(stderr, "Couldn't copy articles: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_exec((sqlite3 *)db->s_db, "ROLLBACK", NULL, NULL, NULL);
+    return 1;
+  }
+  return database_sqlite_commit(db);
+}
+
+/* 4: posters interned in their own table, and the article rows rebuilt
+ * without the poster text or the article_id index, which postings'
+ * (group_id, article_id) key replaced.  The rows are copied a batch per
+ * transaction, so the database stays usable while a big one is migrated
+ * and an interrupted migration carries on where it stopped. */
+static int
+migrate_posters(db)
+  database *db;
+{
+  int res, search;
+  long long low, last;
+  sqlite3_stmt *stmt, *copy_posters, *copy_articles;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM pragma_table_info('articles') WHERE name = 'poster_id'")) != 0)
+    return res < 0;
+  if ((search = migrate_exists(db, "SELECT 1 FROM sqlite_master WHERE name = 'articles_search'")) < 0)
+    return 1;
+
+  if (migrate_exec(db,
+        "CREATE TABLE IF NOT EXISTS posters (id INTEGER PRIMARY KEY, name TEXT UNIQUE);"
+        "CREATE TABLE IF NOT EXISTS articles_new " ARTICLES_TABLE ";", "create posters table") != 0)
+    return 1;
+
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+      "SELECT (SELECT coalesce(max(id), 0) FROM articles_new), (SELECT coalesce(max(id), 0) FROM articles)", -1, &stmt, NULL);
+  if (res != SQLITE_OK || sqlite3_step(stmt) != SQLITE_ROW) {
+    fprintf(stderr, "Couldn't read articles: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_finalize(stmt);
+    return 1;
+  }
+  low = sqlite3_column_int64(stmt, 0);
+  last = sqlite3_column_int64(stmt, 1);
+  sqlite3_finalize(stmt);
+
+  copy_articles = NULL;
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+      "INSERT OR IGNORE INTO posters (name) SELECT poster FROM articles WHERE id > ? AND id <= ? AND poster IS NOT NULL", -1, &copy_posters, NULL);
+  if (res == SQLITE_OK) {
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "INSERT INTO articles_new (id, group_id, article_id, subject, message_id, poster_id, posted_at, posted, bytes, file_id, part) "
+        "SELECT a.id, a.group_id, a.article_id, a.subject, a.message_id, p.id, a.posted_at, a.posted, a.bytes, a.file_id, a.part "
+        "FROM articles a LEFT JOIN posters p ON p.name = a.poster WHERE a.id > ? AND a.id <= ?", -1, &copy_articles, NULL);
+  }
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_finalize(copy_posters);
+    return 1;
+  }
+
+  if (low < last)
+    fprintf(stderr, "Migrating articles %lld-%lld...\n", low + 1, last);
+  for (res = 0; res == 0 && low < last; low += MIGRATE_ROWS)
+    res = migrate_posters_batch(db, copy_posters, copy_articles, low, low + MIGRATE_ROWS);
+  sqlite3_finalize(copy_posters);
+  sqlite3_finalize(copy_articles);
+  if (res != 0)
+    return 1;
+
+  /* the search index reads from whatever is called articles, so only its
+   * triggers need to be put back */
+  return migrate_exec(db,
+      search ?
+      "BEGIN;"
+      "DROP TABLE articles;"
+      "ALTER TABLE articles_new RENAME TO articles;"
+      ARTICLES_INDEXES
+      SEARCH_INDEX_TRIGGERS
+      "COMMIT;" :
+      "BEGIN;"
+      "DROP TABLE articles;"
+      "ALTER TABLE articles_new RENAME TO articles;"
+      ARTICLES_INDEXES
+      "COMMIT;", "replace articles");
+}
+
+/* 5: the lowest article stored for a group that is being backfilled
+ * newest first; NULL for groups crawled from their low mark up */
+static int
+migrate_backfill(db)
+  database *db;
+{
+  int res;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM pragma_table_info('groups') WHERE name = 'first_article_id'")) != 0)
+    return res < 0;
+
+  return migrate_exec(db, "ALTER TABLE groups ADD COLUMN first_article_id INTEGER", "add backfill mark");
+}
+
+/* 6: ranges of articles a group is missing: rows that failed to insert,
+ * and articles that expired before we got to them */
+static int
+migrate_gaps(db)
+  database *db;
+{
+  int res;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM sqlite_master WHERE name = 'gaps'")) != 0)
+    return res < 0;
+
+  return migrate_exec(db, GAPS_TABLE, "create gaps table");
+}
+
+/* 7: the groups an article was posted to, looked up from the article */
+static int
+migrate_postings_article(db)
+  database *db;
+{
+  int res;
+
+  if ((res = migrate_exists(db, "SELECT 1 FROM sqlite_master WHERE name = 'postings_article'")) != 0)
+    return res < 0;
+
+  return migrate_exec(db, POSTINGS_INDEXES, "index postings");
+}
+
+/* 8: the subject and file name search indexes, which pwnntp-nzb used to
+ * build on first use; without FTS5 they're left out and searches scan */
+static int
+migrate_search(db)
+  database *db;
+{
+  int articles, files;
+
+  if ((articles = database_sqlite_has_table(db, "articles_search")) < 0 ||
+      (files = database_sqlite_has_table(db, "files_search")) < 0)
+    return 1;
+  if (articles && files)
+    return 0;
+
+  fprintf(stderr, "Building search indexes...\n");
+  if (database_sqlite_create_search_index(db) != 0)
+    fprintf(stderr, "Continuing without search indexes.\n");
+  return 0;
+}
+
+static int (*migrations[])(database *) = {
+  NULL,
+  migrate_files,
+  migrate_dates,
+  migrate_postings,
+  migrate_posters,
+  migrate_backfill,
+  migrate_gaps,
+  migrate_postings_article,
+  migrate_search
+};
+
+#define SCHEMA_VERSION ((int)(sizeof(migrations) / sizeof(migrations[0])) - 1)
+
+/* the current schema, for a new database */
+int
+database_sqlite_create_schema(db)
+  database *db;
+{
+  char sql[64];
+
+  snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", SCHEMA_VERSION);
+  if (migrate_exec(db,
+        "BEGIN;"
+        "CREATE TABLE groups (id INTEGER PRIMARY KEY, name TEXT, last_article_id INTEGER, first_article_id INTEGER);"
+        "CREATE TABLE posters (id INTEGER PRIMARY KEY, name TEXT UNIQUE);"
+        "CREATE TABLE files (id INTEGER PRIMARY KEY, group_id INTEGER, name TEXT, total_parts INTEGER, parts INTEGER, bytes INTEGER);"
+        "CREATE UNIQUE INDEX files_name ON files (group_id, name, total_parts);"
+        "CREATE TABLE postings (group_id INTEGER, article_id INTEGER, article INTEGER, PRIMARY KEY (group_id, article_id)) WITHOUT ROWID;"
+        POSTINGS_INDEXES
+        "CREATE TABLE articles " ARTICLES_TABLE ";"
+        ARTICLES_INDEXES
+        GAPS_TABLE, "create schema") != 0)
+    return 1;
+  if (migrate_exec(db, sql, "create schema") != 0)
+    return 1;
+  return migrate_exec(db, "COMMIT", "create schema");
+}
+
+/* bring the schema up to date, one migration at a time */
+int
+database_sqlite_migrate(db)
+  database *db;
+{
+  int version;
+  char sql[64];
+  sqlite3_stmt *stmt;
+
+  if (sqlite3_prepare_v2((sqlite3 *)db->s_db, "PRAGMA user_version", -1, &stmt, NULL) != SQLITE_OK ||
+      sqlite3_step(stmt) != SQLITE_ROW) {
+    fprintf(stderr, "Couldn't read schema version: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_finalize(stmt);
+    return 1;
+  }
+  version = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  if (version > SCHEMA_VERSION) {
+    fprintf(stderr, "Database schema version %d is newer than this pwnntp's (%d).\n", version, SCHEMA_VERSION);
+    return 1;
+  }
+  for (version++; version <= SCHEMA_VERSION; version++) {
+#ifdef DEBUG
+    fprintf(stderr, "Migrating database to schema version %d.\n", version);
+#endif
+    if (migrations[version](db) != 0)
+      return 1;
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d", version);
+    if (migrate_exec(db, sql, "set schema version") != 0)
+      return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,544 @@
+/* pwnntp-mock: a local NNTP server that makes up groups of binary posts,
+ * for measuring pwnntp without a provider.  It speaks TLS with the given
+ * certificate, takes any AUTHINFO, and answers GROUP, LIST ACTIVE, XZHDR,
+ * XHDR, XZVER and XOVER with headers synthesized from the article number,
+ * so every run sees the same data.  It can also misbehave on purpose:
+ * hang up every so often, or fail any range holding a given article. */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <zlib.h>
+#include "yenc.h"
+
+#define MOCK_GROUPS 64
+#define MOCK_LINE 128             /* yEnc line length */
+#define MOCK_MISSING 97           /* one article in this many is gone */
+#define MOCK_PARTS 50             /* parts per posted file */
+
+typedef struct {
+  char name[256];
+  long long low;
+  long long high;
+} mock_group;
+
+/* a growable output buffer */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t size;
+} mock_buffer;
+
+static mock_group groups[MOCK_GROUPS];
+static int num_groups = 0;
+static int latency = 0;           /* milliseconds before each reply */
+static int level = Z_DEFAULT_COMPRESSION;
+static int drop = 0;              /* hang up instead of every drop'th reply */
+static int served = 0;
+static long long poison = 0;      /* article whose ranges fail */
+static SSL_CTX *ctx;
+
+static unsigned long long
+mock_hash(x)
+  unsigned long long x;
+{
+  /* splitmix64 */
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static int
+mock_reserve(buf, len)
+  mock_buffer *buf;
+  size_t len;
+{
+  char *data;
+  size_t size;
+
+  if (buf->len + len <= buf->size)
+    return 0;
+  for (size = buf->size > 0 ? buf->size : 65536; size < buf->len + len; size *= 2);
+  if ((data = (char *)realloc(buf->data, size)) == NULL) {
+    perror("realloc");
+    return 1;
+  }
+  buf->data = data;
+  buf->size = size;
+  return 0;
+}
+
+static int
+mock_append(buf, s, len)
+  mock_buffer *buf;
+  const char *s;
+  size_t len;
+{
+  if (mock_reserve(buf, len) != 0)
+    return 1;
+  memcpy(buf->data + buf->len, s, len);
+  buf->len += len;
+  return 0;
+}
+
+/* one header field of article n of group g, without the CRLF; returns
+ * its length, or 0 if the field isn't known */
+static int
+mock_field(g, n, field, out, size)
+  mock_group *g;
+  long long n;
+  const char *field;
+  char *out;
+  size_t size;
+{
+  unsigned long long h = mock_hash((unsigned long long)n ^ mock_hash((unsigned long long)(g - groups)));
+  unsigned long long file = mock_hash((unsigned long long)(n / MOCK_PARTS) ^ (unsigned long long)(g - groups));
+  time_t t = 1600000000 + (time_t)n * 7;
+  struct tm tm;
+
+  if (strcasecmp(field, "Subject") == 0) {
+    return snprintf(out, size, "[%llu/%d] - \"bench-%012llx.part%02d.rar\" yEnc (%d/%d)",
+        (file % 40) + 1, 40, file & 0xffffffffffffULL, (int)(file % 20) + 1,
+        (int)(n % MOCK_PARTS) + 1, MOCK_PARTS);
+  }
+  if (strcasecmp(field, "From") == 0) {
+    return snprintf(out, size, "poster%llu <poster%llu@example.com>", file % 500, file % 500);
+  }
+  if (strcasecmp(field, "Date") == 0) {
+    gmtime_r(&t, &tm);
+    return (int)strftime(out, size, "%a, %d %b %Y %H:%M:%S +0000", &tm);
+  }
+  if (strcasecmp(field, "Message-ID") == 0) {
+    return snprintf(out, size, "<part%dof%d.%016llx@bench.example>",
+        (int)(n % MOCK_PARTS) + 1, MOCK_PARTS, h);
+  }
+  if (strcasecmp(field, "Bytes") == 0) {
+    return snprintf(out, size, "%llu", 390000 + h % 20000);
+  }
+  if (strcasecmp(field, "Lines") == 0) {
+    return snprintf(out, size, "%llu", 3000 + h % 160);
+  }
+  return 0;
+}
+
+/* the records for articles low..high: "<n> <field>\r\n" for a field, or
+ * overview lines if field is NULL */
+static int
+mock_records(g, field, low, high, buf)
+  mock_group *g;
+  const char *field;
+  long long low;
+  long long high;
+  mock_buffer *buf;
+{
+  static const char *overview[] = { "Subject", "From", "Date", "Message-ID", NULL, "Bytes", "Lines" };
+  char rec[2048];
+  long long n;
+  int i, len;
+
+  for (n = low; n <= high; n++) {
+    if (mock_hash((unsigned long long)n) % MOCK_MISSING == 0)
+      continue;
+    len = snprintf(rec, sizeof(rec), "%lld", n);
+    for (i = 0; field == NULL && i < 7; i++) {
+      rec[len++] = '\t';
+      if (overview[i] != NULL)
+        len += mock_field(g, n, overview[i], rec + len, sizeof(rec) - len - 2);
+    }
+    if (field != NULL) {
+      rec[len++] = ' ';
+      len += mock_field(g, n, field, rec + len, sizeof(rec) - len - 2);
+    }
+    rec[len++] = '\r';
+    rec[len++] = '\n';
+    if (mock_append(buf, rec, len) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+/* raw deflate, then yEnc, the way XZHDR and XZVER replies come */
+static int
+mock_compress(in, zbuf, out)
+  mock_buffer *in;
+  mock_buffer *zbuf;
+  mock_buffer *out;
+{
+  z_stream strm;
+  char end[128];
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return 1;
+  zbuf->len = 0;
+  if (mock_reserve(zbuf, deflateBound(&strm, in->len)) != 0) {
+    deflateEnd(&strm);
+    return 1;
+  }
+  strm.next_in = (unsigned char *)in->data;
+  strm.avail_in = in->len;
+  strm.next_out = (unsigned char *)zbuf->data;
+  strm.avail_out = zbuf->size;
+  if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&strm);
+    return 1;
+  }
+  zbuf->len = strm.total_out;
+  deflateEnd(&strm);
+
+  /* worst case every byte is escaped, plus line ends */
+  if (mock_reserve(out, zbuf->len * 2 + (zbuf->len / MOCK_LINE + 1) * 2 + 256) != 0)
+    return 1;
+  mock_append(out, "=ybegin line=128 size=-1\r\n", 26);
+  out->len += yenc_encode(out->data + out->len, (unsigned char *)zbuf->data, zbuf->len, MOCK_LINE);
+  snprintf(end, sizeof(end), "\r\n=yend size=%lu part=0 pcrc32=00000000\r\n", (unsigned long)zbuf->len);
+  return mock_append(out, end, strlen(end));
+}
+
+/* the lines of an uncompressed block, dot-stuffed */
+static int
+mock_stuff(in, out)
+  mock_buffer *in;
+  mock_buffer *out;
+{
+  char *rec = in->data, *end = in->data + in->len, *eol;
+
+  while (rec < end && (eol = (char *)memchr(rec, '\n', end - rec)) != NULL) {
+    if (*rec == '.' && mock_append(out, ".", 1) != 0)
+      return 1;
+    if (mock_append(out, rec, eol + 1 - rec) != 0)
+      return 1;
+    rec = eol + 1;
+  }
+  return 0;
+}
+
+static mock_group *
+mock_find(name)
+  const char *name;
+{
+  int i;
+
+  for (i = 0; i < num_groups; i++) {
+    if (strcmp(groups[i].name, name) == 0)
+      return &groups[i];
+  }
+  return NULL;
+}
+
+typedef struct {
+  SSL *ssl;
+  int fd;
+  mock_group *group;
+  mock_buffer records, zbuf, out;
+} mock_session;
+
+static int
+mock_send(m, s, len)
+  mock_session *m;
+  const char *s;
+  size_t len;
+{
+  int n;
+
+  while (len > 0) {
+    if ((n = SSL_write(m->ssl, s, len > 1 << 30 ? 1 << 30 : (int)len)) <= 0)
+      return 1;
+    s += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* answer one command line; returns 1 once the session is over */
+static int
+mock_command(m, line)
+  mock_session *m;
+  char *line;
+{
+  char *argv[4], *cmd, reply[512];
+  const char *field = NULL;
+  int argc, compressed, i;
+  long long low, high;
+  mock_group *g;
+
+  for (argc = 0, cmd = strtok(line, " \t"); cmd != NULL && argc < 4; cmd = strtok(NULL, " \t"))
+    argv[argc++] = cmd;
+  if (argc == 0)
+    return mock_send(m, "500 what?\r\n", 11);
+  if (latency > 0)
+    usleep(latency * 1000);
+
+  if (strcasecmp(argv[0], "QUIT") == 0) {
+    mock_send(m, "205 bye\r\n", 9);
+    return 1;
+  }
+  if (strcasecmp(argv[0], "AUTHINFO") == 0 && argc > 1) {
+    if (strcasecmp(argv[1], "USER") == 0)
+      return mock_send(m, "381 more\r\n", 10);
+    return mock_send(m, "281 ok\r\n", 8);
+  }
+  if (strcasecmp(argv[0], "GROUP") == 0 && argc > 1) {
+    if ((g = mock_find(argv[1])) == NULL)
+      return mock_send(m, "411 no such group\r\n", 19);
+    m->group = g;
+    snprintf(reply, sizeof(reply), "211 %lld %lld %lld %.255s\r\n", g->high - g->low + 1, g->low, g->high, g->name);
+    return mock_send(m, reply, strlen(reply));
+  }
+  if (strcasecmp(argv[0], "LIST") == 0) {
+    m->out.len = 0;
+    mock_append(&m->out, "215 list follows\r\n", 18);
+    for (i = 0; i < num_groups; i++) {
+      if (argc > 2 && fnmatch(argv[2], groups[i].name, 0) != 0)
+        continue;
+      snprintf(reply, sizeof(reply), "%.255s %lld %lld y\r\n", groups[i].name, groups[i].high, groups[i].low);
+      mock_append(&m->out, reply, strlen(reply));
+    }
+    mock_append(&m->out, ".\r\n", 3);
+    return mock_send(m, m->out.data, m->out.len);
+  }
+
+  compressed = argv[0][0] != '\0' && (argv[0][1] == 'Z' || argv[0][1] == 'z');
+  if (strcasecmp(argv[0], "XZHDR") == 0 || strcasecmp(argv[0], "XHDR") == 0) {
+    if (argc < 3)
+      return mock_send(m, "501 syntax\r\n", 12);
+    field = argv[1];
+    argv[1] = argv[2];
+  }
+  else if (strcasecmp(argv[0], "XZVER") != 0 && strcasecmp(argv[0], "XOVER") != 0) {
+    return mock_send(m, "500 what?\r\n", 11);
+  }
+  if ((g = m->group) == NULL)
+    return mock_send(m, "412 no group selected\r\n", 23);
+  if (argc < 2 || sscanf(argv[1], "%lld-%lld", &low, &high) < 1)
+    return mock_send(m, "501 syntax\r\n", 12);
+  if (strchr(argv[1], '-') == NULL)
+    high = low;
+  else if (argv[1][strlen(argv[1]) - 1] == '-')
+    high = g->high;
+  if (low < g->low)
+    low = g->low;
+  if (high > g->high)
+    high = g->high;
+  if (poison >= low && poison <= high)
+    return mock_send(m, "403 can't read that range\r\n", 27);
+  if (drop > 0 && __sync_add_and_fetch(&served, 1) % drop == 0)
+    return 1;
+
+  m->records.len = m->out.len = 0;
+  if (mock_records(g, field, low, high, &m->records) != 0)
+    return 1;
+  if (m->records.len == 0)
+    return mock_send(m, "423 no articles in that range\r\n", 31);
+  mock_append(&m->out, field != NULL ? "221 headers follow\r\n" : "224 overview follows\r\n", field != NULL ? 20 : 22);
+  if (compressed ? mock_compress(&m->records, &m->zbuf, &m->out) : mock_stuff(&m->records, &m->out))
+    return 1;
+  mock_append(&m->out, ".\r\n", 3);
+  return mock_send(m, m->out.data, m->out.len);
+}
+
+static void *
+mock_session_main(arg)
+  void *arg;
+{
+  mock_session *m = (mock_session *)arg;
+  char buf[8192], *eol, *line;
+  size_t len = 0;
+  int n, done = 0;
+
+  if (SSL_accept(m->ssl) <= 0 || mock_send(m, "200 pwnntp-mock ready\r\n", 23) != 0)
+    done = 1;
+  while (!done) {
+    if ((n = SSL_read(m->ssl, buf + len, sizeof(buf) - len - 1)) <= 0)
+      break;
+    len += n;
+    buf[len] = 0;
+    line = buf;
+    while (!done && (eol = strstr(line, "\r\n")) != NULL) {
+      *eol = 0;
+      done = mock_command(m, line);
+      line = eol + 2;
+    }
+    len -= line - buf;
+    memmove(buf, line, len);
+    if (len == sizeof(buf) - 1)
+      break;
+  }
+
+  SSL_shutdown(m->ssl);
+  SSL_free(m->ssl);
+  close(m->fd);
+  free(m->records.data);
+  free(m->zbuf.data);
+  free(m->out.data);
+  free(m);
+  return NULL;
+}
+
+/* NAME:LOW:HIGH */
+static int
+mock_add_group(spec)
+  const char *spec;
+{
+  mock_group *g;
+  const char *colon;
+
+  if (num_groups == MOCK_GROUPS || (colon = strchr(spec, ':')) == NULL || colon - spec >= (int)sizeof(g->name))
+    return 1;
+  g = &groups[num_groups];
+  memcpy(g->name, spec, colon - spec);
+  g->name[colon - spec] = 0;
+  if (sscanf(colon + 1, "%lld:%lld", &g->low, &g->high) != 2 || g->low < 1 || g->high < g->low)
+    return 1;
+  num_groups++;
+  return 0;
+}
+
+void
+print_syntax(name)
+  const char *name;
+{
+  printf("%s options:\n", name);
+  printf("  -p, --port PORT           (default: 5563)\n");
+  printf("  -c, --cert FILE           (PEM certificate chain)\n");
+  printf("  -k, --key FILE            (PEM private key)\n");
+  printf("  -g, --group NAME:LOW:HIGH (may be repeated)\n");
+  printf("  -n, --articles N          (size of alt.binaries.bench if no -g; default: 500000)\n");
+  printf("  -l, --latency MS          (delay before each reply; default: 0)\n");
+  printf("  -z, --level N             (deflate level for XZHDR/XZVER; default: zlib's)\n");
+  printf("  -d, --drop N              (hang up instead of sending every Nth range reply)\n");
+  printf("  -x, --poison ID           (fail every range holding article ID)\n");
+}
+
+int
+main(argc, argv)
+  int argc;
+  char *argv[];
+{
+  int c, fd, sock, one = 1, port = 5563;
+  long long articles = 500000;
+  char *cert = NULL, *key = NULL, spec[64];
+  struct sockaddr_in addr;
+  mock_session *m;
+  pthread_t thread;
+
+  while (1)
+  {
+    static struct option long_options[] =
+    {
+      {"port"    , required_argument, 0, 'p'},
+      {"cert"    , required_argument, 0, 'c'},
+      {"key"     , required_argument, 0, 'k'},
+      {"group"   , required_argument, 0, 'g'},
+      {"articles", required_argument, 0, 'n'},
+      {"latency" , required_argument, 0, 'l'},
+      {"level"   , required_argument, 0, 'z'},
+      {"drop"    , required_argument, 0, 'd'},
+      {"poison"  , required_argument, 0, 'x'},
+      {0, 0, 0, 0}
+    };
+    int option_index = 0;
+    c = getopt_long (argc, argv, "p:c:k:g:n:l:z:d:x:", long_options, &option_index);
+
+    if (c == -1)
+      break;
+
+    switch (c)
+    {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'c':
+        cert = optarg;
+        break;
+      case 'k':
+        key = optarg;
+        break;
+      case 'g':
+        if (mock_add_group(optarg) != 0) {
+          fprintf(stderr, "Bad group %s.\n", optarg);
+          return 1;
+        }
+        break;
+      case 'n':
+        articles = atoll(optarg);
+        break;
+      case 'l':
+        latency = atoi(optarg);
+        break;
+      case 'z':
+        level = atoi(optarg);
+        break;
+      case 'd':
+        drop = atoi(optarg);
+        break;
+      case 'x':
+        poison = atoll(optarg);
+        break;
+      default:
+        print_syntax(argv[0]);
+        return 1;
+    }
+  }
+  if (cert == NULL || key == NULL || articles < 1) {
+    print_syntax(argv[0]);
+    return 1;
+  }
+  if (num_groups == 0) {
+    snprintf(spec, sizeof(spec), "alt.binaries.bench:1:%lld", articles);
+    mock_add_group(spec);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  SSL_library_init();
+  SSL_load_error_strings();
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == NULL || SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+      SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1) {
+    fprintf(stderr, "Couldn't load certificate: %s\n", ERR_reason_error_string(ERR_get_error()));
+    return 1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 64) != 0) {
+    perror("listen");
+    return 1;
+  }
+
+  while ((fd = accept(sock, NULL, NULL)) >= 0) {
+    if ((m = (mock_session *)calloc(1, sizeof(mock_session))) == NULL) {
+      close(fd);
+      continue;
+    }
+    m->fd = fd;
+    m->ssl = SSL_new(ctx);
+    SSL_set_fd(m->ssl, fd);
+    if (pthread_create(&thread, NULL, mock_session_main, m) != 0) {
+      SSL_free(m->ssl);
+      close(fd);
+      free(m);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  perror("accept");
+  return 1;
+}
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+#include "sqlite.h"
+#include "hash.h"
+
+#define NZB_SUFFIX "[[:space:]]*\\(([0-9]+)/([0-9]+)\\)[[:space:]]*$"
+#define NZB_DEFAULT_REGEXP "(.*[^[:space:]])"
+
+typedef struct {
+  int part;
+  long long bytes;
+  char *message_id;
+} nzb_segment;
+
+typedef struct {
+  char *name;
+  int total;
+  long long *group_ids;
+  int num_groups;
+  nzb_segment *segments;
+  int num_segments;
+  int size;
+} nzb_file;
+
+typedef struct {
+  nzb_file **files;     /* in the order they were found */
+  int num_files;
+  int size;
+  hash *by_name;
+} nzb;
+
+static nzb_file *
+nzb_find_file(n, name, len, total)
+  nzb *n;
+  const char *name;
+  size_t len;
+  int total;
+{
+  void **slot;
+  nzb_file *f, **files;
+
+  if ((slot = hash_lookup(n->by_name, name, len, 1)) == NULL)
+    return NULL;
+  if (*slot != NULL)
+    return (nzb_file *)*slot;
+
+  if (n->num_files == n->size) {
+    n->size = n->size == 0 ? 64 : n->size * 2;
+    files = (nzb_file **)realloc(n->files, sizeof(nzb_file *) * n->size);
+    if (files == NULL) {
+      perror("realloc");
+      return NULL;
+    }
+    n->files = files;
+  }
+
+  f = (nzb_file *)calloc(1, sizeof(nzb_file));
+  if (f == NULL || (f->name = strndup(name, len)) == NULL) {
+    perror("malloc");
+    free(f);
+    return NULL;
+  }
+  f->total = total;
+  fprintf(stderr, "Found file: %s\n", f->name);
+
+  n->files[n->num_files++] = f;
+  *slot = f;
+  return f;
+}
+
+static int
+nzb_add_segment(f, group_id, part, message_id, mlen, bytes)
+  nzb_file *f;
+  long long group_id;
+  int part;
+  const char *message_id;
+  int mlen;
+  long long bytes;
+{
+  int i;
+  long long *group_ids;
+  nzb_segment *segments;
+
+  for (i = 0; i < f->num_groups && f->group_ids[i] != group_id; i++);
+  if (i == f->num_groups) {
+    group_ids = (long long *)realloc(f->group_ids, sizeof(long long) * (f->num_groups + 1));
+    if (group_ids == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    f->group_ids = group_ids;
+    f->group_ids[f->num_groups++] = group_id;
+  }
+
+  if (f->num_segments == f->size) {
+    f->size = f->size == 0 ? 16 : f->size * 2;
+    segments = (nzb_segment *)realloc(f->segments, sizeof(nzb_segment) * f->size);
+    if (segments == NULL) {
+      perror("realloc");
+      return 1;
+    }
+    f->segments = segments;
+  }
+
+  /* strip the angle brackets */
+  if (mlen > 0 && message_id[0] == '<') {
+    message_id++;
+    mlen--;
+  }
+  if (mlen > 0 && message_id[mlen - 1] == '>')
+    mlen--;
+
+  f->segments[f->num_segments].part = part;
+  f->segments[f->num_segments].bytes = bytes;
+  if ((f->segments[f->num_segments].message_id = strndup(message_id, mlen)) == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  f->num_segments++;
+  return 0;
+}
+
+static int
+nzb_segment_cmp(a, b)
+  const void *a;
+  const void *b;
+{
+  const nzb_segment *sa = (const nzb_segment *)a, *sb = (const nzb_segment *)b;
+
+  if (sa->part != sb->part)
+    return sa->part - sb->part;
+  return strcmp(sa->message_id, sb->message_id);
+}
+
+static void
+nzb_puts_escaped(s)
+  const char *s;
+{
+  for (; *s; s++) {
+    switch (*s) {
+      case '&': fputs("&amp;", stdout); break;
+      case '<': fputs("&lt;", stdout); break;
+      case '>': fputs("&gt;", stdout); break;
+      case '"': fputs("&quot;", stdout); break;
+      default: putchar(*s);
+    }
+  }
+}
+
+/* write out every file; a crossposted part is read once for each group
+ * it was posted to, so duplicate segments are dropped */
+static void
+nzb_write(n, groups)
+  nzb *n;
+  hash *groups;
+{
+  int i, j;
+  char key[32];
+  void **name;
+  nzb_file *f;
+
+  printf("<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n");
+  printf("<!DOCTYPE nzb PUBLIC \"-//newzBin//DTD NZB 1.0//EN\" \"http://www.newzbin.com/DTD/nzb/nzb-1.0.dtd\">\n");
+  printf("<nzb xmlns=\"http://www.newzbin.com/DTD/2003/nzb\">\n");
+  for (i = 0; i < n->num_files; i++) {
+    f = n->files[i];
+    printf("  <file subject=\"");
+    nzb_puts_escaped(f->name);
+    printf(" (1/%d)\">\n", f->total);
+
+    printf("    <groups>\n");
+    for (j = 0; j < f->num_groups; j++) {
+      snprintf(key, sizeof(key), "%lld", f->group_ids[j]);
+      if ((name = hash_lookup(groups, key, strlen(key), 0)) == NULL)
+        continue;
+      printf("      <group>");
+      nzb_puts_escaped((const char *)*name);
+      printf("</group>\n");
+    }
+    printf("    </groups>\n");
+
+    printf("    <segments>\n");
+    qsort(f->segments, f->num_segments, sizeof(nzb_segment), nzb_segment_cmp);
+    for (j = 0; j < f->num_segments; j++) {
+      if (j > 0 && nzb_segment_cmp(&f->segments[j - 1], &f->segments[j]) == 0)
+        continue;
+      printf("      <segment number=\"%d\" bytes=\"%lld\">", f->segments[j].part, f->segments[j].bytes);
+      nzb_puts_escaped(f->segments[j].message_id);
+      printf("</segment>\n");
+    }
+    printf("    </segments>\n");
+    printf("  </file>\n");
+  }
+  printf("</nzb>\n");
+  fflush(stdout);
+}
+
+static void
+nzb_free(n)
+  nzb *n;
+{
+  int i, j;
+
+  for (i = 0; i < n->num_files; i++) {
+    for (j = 0; j < n->files[i]->num_segments; j++)
+      free(n->files[i]->segments[j].message_id);
+    free(n->files[i]->segments);
+    free(n->files[i]->group_ids);
+    free(n->files[i]->name);
+    free(n->files[i]);
+  }
+  free(n->files);
+  hash_free(n->by_name, NULL);
+}
+
+/* id -> name for every group */
+static hash *
+nzb_load_groups(db)
+  database *db;
+{
+  hash *groups;
+  sqlite3_stmt *stmt;
+  void **slot;
+  const char *id;
+
+  if ((groups = hash_new(64)) == NULL)
+    return NULL;
+  if (sqlite3_prepare_v2((sqlite3 *)db->s_db, "SELECT id, name FROM groups", -1, &stmt, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    hash_free(groups, NULL);
+    return NULL;
+  }
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    id = (const char *)sqlite3_column_text(stmt, 0);
+    if ((slot = hash_lookup(groups, id, strlen(id), 1)) != NULL && *slot == NULL)
+      *slot = strdup((const char *)sqlite3_column_text(stmt, 1));
+  }
+  sqlite3_finalize(stmt);
+  return groups;
+}
+
+/* search as one FTS phrase, its quotes doubled */
+static char *
+nzb_phrase(search)
+  const char *search;
+{
+  char *phrase, *p;
+
+  if ((phrase = (char *)malloc(strlen(search) * 2 + 3)) == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  p = phrase;
+  *p++ = '"';
+  for (; *search; search++) {
+    if (*search == '"')
+      *p++ = '"';
+    *p++ = *search;
+  }
+  *p++ = '"';
+  *p = 0;
+  return phrase;
+}
+
+/* collect the parts of every subject matching search, split with regex */
+static int
+nzb_from_subjects(db, n, search, regexp)
+  database *db;
+  nzb *n;
+  const char *search;
+  const char *regexp;
+{
+  int res, len, part, total, indexed;
+  char *pattern, *search_phrase;
+  const char *subject;
+  regex_t regex;
+  regmatch_t *m;
+  nzb_file *f;
+  sqlite3_stmt *stmt;
+
+  if ((pattern = (char *)malloc(strlen(regexp) + strlen(NZB_SUFFIX) + 1)) == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  sprintf(pattern, "%s%s", regexp, NZB_SUFFIX);
+  if ((res = regcomp(&regex, pattern, REG_EXTENDED)) != 0) {
+    fprintf(stderr, "Bad regexp: %s\n", pattern);
+    free(pattern);
+    return 1;
+  }
+  free(pattern);
+
+  /* the part and total are the last two groups */
+  m = (regmatch_t *)malloc(sizeof(regmatch_t) * (regex.re_nsub + 1));
+  if (m == NULL || regex.re_nsub < 3) {
+    fprintf(stderr, "Couldn't set up search.\n");
+    free(m);
+    regfree(&regex);
+    return 1;
+  }
+
+  /* the trigram index only helps with three or more characters */
+  indexed = strlen(search) >= 3 && database_sqlite_has_table(db, "articles_search") == 1;
+  if (indexed) {
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "SELECT p.group_id, a.subject, a.message_id, a.bytes FROM articles_search s "
+        "JOIN articles a ON a.id = s.rowid JOIN postings p ON p.article = a.id WHERE articles_search MATCH ?", -1, &stmt, NULL);
+    search_phrase = nzb_phrase(search);
+  }
+  else {
+    fprintf(stderr, "Searching without the index.\n");
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "SELECT p.group_id, a.subject, a.message_id, a.bytes FROM articles a "
+        "JOIN postings p ON p.article = a.id WHERE a.subject LIKE '%' || ? || '%'", -1, &stmt, NULL);
+    if ((search_phrase = strdup(search)) == NULL)
+      perror("malloc");
+  }
+  if (res != SQLITE_OK || search_phrase == NULL) {
+    if (res != SQLITE_OK)
+      fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_finalize(stmt);
+    free(search_phrase);
+    free(m);
+    regfree(&regex);
+    return 1;
+  }
+  sqlite3_bind_text(stmt, 1, search_phrase, -1, SQLITE_STATIC);
+
+  res = 0;
+  while (res == 0 && sqlite3_step(stmt) == SQLITE_ROW) {
+    subject = (const char *)sqlite3_column_text(stmt, 1);
+    if (subject == NULL || regexec(&regex, subject, regex.re_nsub + 1, m, 0) != 0 || m[1].rm_so < 0) {
+      fprintf(stderr, "Couldn't parse subject: %s\n", subject == NULL ? "" : subject);
+      continue;
+    }
+    part = atoi(subject + m[regex.re_nsub - 1].rm_so);
+    total = atoi(subject + m[regex.re_nsub].rm_so);
+    len = sqlite3_column_bytes(stmt, 2);
+
+    if ((f = nzb_find_file(n, subject + m[1].rm_so, m[1].rm_eo - m[1].rm_so, total)) == NULL) {
+      res = 1;
+      break;
+    }
+    res = nzb_add_segment(f, sqlite3_column_int64(stmt, 0), part,
+        (const char *)sqlite3_column_text(stmt, 2), len, sqlite3_column_int64(stmt, 3));
+  }
+  sqlite3_finalize(stmt);
+  free(search_phrase);
+  regfree(&regex);
+  free(m);
+  return res;
+}
+
+/* collect the parts of every file whose name contains search, from the
+ * files pwnntp assembled while ingesting; like subjects, names are matched
+ * without regard to case */
+static int
+nzb_from_files(db, n, search)
+  database *db;
+  nzb *n;
+  const char *search;
+{
+  int res;
+  char *search_phrase;
+  const char *name;
+  nzb_file *f;
+  sqlite3_stmt *files, *parts;
+
+  /* the trigram index only helps with three or more characters */
+  if (strlen(search) >= 3 && database_sqlite_has_table(db, "files_search") == 1) {
+    if ((search_phrase = nzb_phrase(search)) == NULL)
+      return 1;
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "SELECT f.id, f.name, f.total_parts FROM files_search s JOIN files f ON f.id = s.rowid "
+        "WHERE files_search MATCH ? ORDER BY f.id", -1, &files, NULL);
+  }
+  else {
+    fprintf(stderr, "Searching without the index.\n");
+    if ((search_phrase = strdup(search)) == NULL) {
+      perror("malloc");
+      return 1;
+    }
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "SELECT id, name, total_parts FROM files WHERE name LIKE '%' || ? || '%' ORDER BY id", -1, &files, NULL);
+  }
+  if (res == SQLITE_OK) {
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db,
+        "SELECT p.group_id, a.part, a.message_id, a.bytes FROM articles a "
+        "JOIN postings p ON p.article = a.id WHERE a.file_id = ? ORDER BY a.part", -1, &parts, NULL);
+    if (res != SQLITE_OK)
+      sqlite3_finalize(files);
+  }
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    free(search_phrase);
+    return 1;
+  }
+  sqlite3_bind_text(files, 1, search_phrase, -1, SQLITE_STATIC);
+
+  res = 0;
+  while (res == 0 && sqlite3_step(files) == SQLITE_ROW) {
+    name = (const char *)sqlite3_column_text(files, 1);
+    if ((f = nzb_find_file(n, name, sqlite3_column_bytes(files, 1), sqlite3_column_int(files, 2))) == NULL) {
+      res = 1;
+      break;
+    }
+    sqlite3_bind_int64(parts, 1, sqlite3_column_int64(files, 0));
+    while (res == 0 && sqlite3_step(parts) == SQLITE_ROW) {
+      res = nzb_add_segment(f, sqlite3_column_int64(parts, 0), sqlite3_column_int(parts, 1),
+          (const char *)sqlite3_column_text(parts, 2), sqlite3_column_bytes(parts, 2), sqlite3_column_int64(parts, 3));
+    }
+    sqlite3_reset(parts);
+  }
+  sqlite3_finalize(parts);
+  sqlite3_finalize(files);
+  free(search_phrase);
+  return res;
+}
+
+int
+main(argc, argv)
+  int argc;
+  char *argv[];
+{
+  int res;
+  database *db;
+  hash *groups;
+  nzb n;
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s DATABASE SEARCH [REGEXP]\n", argv[0]);
+    fprintf(stderr, "  Without REGEXP, files whose name contains SEARCH are written out.\n");
+    fprintf(stderr, "  With it, subjects containing SEARCH are split by REGEXP (POSIX extended),\n");
+    fprintf(stderr, "  which must capture the file name in its first group; \" (part/total)\"\n");
+    fprintf(stderr, "  is matched after it.\n");
+    return 1;
+  }
+
+  n.files = NULL;
+  n.num_files = n.size = 0;
+  if ((n.by_name = hash_new(1024)) == NULL) {
+    return 1;
+  }
+  if ((db = database_open(sqlite, argv[1])) == NULL) {
+    hash_free(n.by_name, NULL);
+    return 1;
+  }
+
+  if (argc == 4)
+    res = nzb_from_subjects(db, &n, argv[2], argv[3]);
+  else
+    res = nzb_from_files(db, &n, argv[2]);
+
+  if (res == 0 && (groups = nzb_load_groups(db)) != NULL) {
+    nzb_write(&n, groups);
+    hash_free(groups, free);
+  }
+  nzb_free(&n);
+  database_close(db);
+  return res;
+}
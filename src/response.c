@@ -11,11 +11,21 @@ nntp_response_free(n_res)
   free(n_res);
 }
 
+/* read a response's status line, but leave any multiline data block on
+ * the connection for the caller to read */
 nntp_response *
-nntp_receive(n_conn)
+nntp_receive_head(n_conn)
   nntp_conn *n_conn;
 {
-  int res, multiline = 0;
+  return nntp_response_parse(nntp_read(n_conn, "\r\n", 2));
+}
+
+/* make a response of a status line, which it takes over; a NULL line
+ * is taken as a failed read */
+nntp_response *
+nntp_response_parse(line)
+  char *line;
+{
   nntp_response *n_res;
 
   n_res = (nntp_response *)malloc(sizeof(nntp_response));
@@ -24,13 +34,14 @@ nntp_receive(n_conn)
   n_res->msg = NULL;
   n_res->data = NULL;
 
-  /* nntp response code */
-  res = BIO_read(n_conn->bio, n_res->code, 3);
-  if (res != 3) {
+  /* status line: a three digit code, then the message */
+  n_res->_msg = line;
+  if (n_res->_msg == NULL || strlen(n_res->_msg) < 3) {
     nntp_response_free(n_res);
-    fprintf(stderr, "Couldn't read: %s\n", ERR_reason_error_string(ERR_get_error()));
+    fprintf(stderr, "Couldn't read response.\n");
     return NULL;
   }
+  memcpy(n_res->code, n_res->_msg, 3);
   n_res->code[3] = 0;
 
   /* set status code */
@@ -43,23 +54,54 @@ nntp_receive(n_conn)
   else if (strcmp("211", n_res->code) == 0) {
     n_res->status = NNTP_GROUP_OK;
   }
+  else if (strcmp("215", n_res->code) == 0) {
+    n_res->status = NNTP_LIST_OK;
+  }
   else if (strcmp("221", n_res->code) == 0) {
-    multiline = 1;
     n_res->status = NNTP_XZHDR_OK;
   }
+  else if (strcmp("224", n_res->code) == 0) {
+    n_res->status = NNTP_OVERVIEW_OK;
+  }
   else if (strcmp("281", n_res->code) == 0) {
     n_res->status = NNTP_AUTH_OK;
   }
   else if (strcmp("381", n_res->code) == 0) {
     n_res->status = NNTP_PASS_REQUIRED;
   }
+  else if (strcmp("400", n_res->code) == 0) {
+    n_res->status = NNTP_SERVICE_UNAVAILABLE;
+  }
+  else if (strcmp("403", n_res->code) == 0) {
+    n_res->status = NNTP_INTERNAL_FAULT;
+  }
+  else if (strcmp("411", n_res->code) == 0) {
+    n_res->status = NNTP_NO_SUCH_GROUP;
+  }
+  else if (strcmp("423", n_res->code) == 0) {
+    n_res->status = NNTP_NO_ARTICLES;
+  }
+  else if (strcmp("480", n_res->code) == 0) {
+    n_res->status = NNTP_AUTH_REQUIRED;
+  }
+  else if (strcmp("481", n_res->code) == 0) {
+    n_res->status = NNTP_AUTH_REJECTED;
+  }
+  else if (strcmp("500", n_res->code) == 0) {
+    n_res->status = NNTP_UNKNOWN_COMMAND;
+  }
+  else if (strcmp("501", n_res->code) == 0) {
+    n_res->status = NNTP_SYNTAX_ERROR;
+  }
+  else if (strcmp("502", n_res->code) == 0) {
+    n_res->status = NNTP_ACCESS_DENIED;
+  }
   else {
     fprintf(stderr, "Unrecognized code: <%s>\n", n_res->code);
   }
 
-  /* nntp response body; 'strip' off leading spaces */
-  n_res->_msg = nntp_read(n_conn, "\r\n", 2);
-  for (n_res->msg = n_res->_msg; *n_res->msg == ' '; n_res->msg++);
+  /* nntp response message; 'strip' off leading spaces */
+  for (n_res->msg = n_res->_msg + 3; *n_res->msg == ' '; n_res->msg++);
 
 #ifdef DEBUG
   fprintf(stderr, "%s: %s\n", n_res->code, n_res->msg);
@@ -69,9 +111,24 @@ nntp_receive(n_conn)
   if (n_res->status == NNTP_GROUP_OK) {
     n_res->data = (void *)nntp_group_new(n_res->msg);
   }
-  else if (multiline) {
+
+  return n_res;
+}
+
+nntp_response *
+nntp_receive(n_conn)
+  nntp_conn *n_conn;
+{
+  nntp_response *n_res;
+
+  n_res = nntp_receive_head(n_conn);
+  if (n_res == NULL) {
+    return NULL;
+  }
+
+  if (n_res->status == NNTP_XZHDR_OK || n_res->status == NNTP_OVERVIEW_OK) {
     /* handle multiline */
-    n_res->data = (void *)nntp_read(n_conn, "\r\n.\r\n", 3);
+    n_res->data = (void *)nntp_read_block(n_conn);
     /*
     if (DEBUG)
       fprintf(stderr, "=====\n%s\n=====\n", (char *)n_res->data);
@@ -6,9 +6,20 @@
 #define NNTP_OK 200
 #define NNTP_QUIT 205
 #define NNTP_GROUP_OK 211
+#define NNTP_LIST_OK 215
 #define NNTP_XZHDR_OK 221
+#define NNTP_OVERVIEW_OK 224
 #define NNTP_AUTH_OK 281
 #define NNTP_PASS_REQUIRED 381
+#define NNTP_SERVICE_UNAVAILABLE 400
+#define NNTP_INTERNAL_FAULT 403
+#define NNTP_NO_SUCH_GROUP 411
+#define NNTP_NO_ARTICLES 423
+#define NNTP_AUTH_REQUIRED 480
+#define NNTP_AUTH_REJECTED 481
+#define NNTP_UNKNOWN_COMMAND 500
+#define NNTP_SYNTAX_ERROR 501
+#define NNTP_ACCESS_DENIED 502
 
 typedef struct {
   char code[4];
@@ -20,5 +31,7 @@ typedef struct {
 
 void nntp_response_free(nntp_response *);
 nntp_response *nntp_receive(nntp_conn *);
+nntp_response *nntp_receive_head(nntp_conn *);
+nntp_response *nntp_response_parse(char *);
 
 #endif
@@ -0,0 +1,399 @@
+#include "main.h"
+#include "schedule.h"
+#include "session.h"
+#include "decode.h"
+
+schedule *
+schedule_new()
+{
+  schedule *s;
+
+  s = (schedule *)malloc(sizeof(schedule));
+  if (s == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  s->groups = NULL;
+  s->count = s->size = 0;
+  s->poll_min = POLL_MIN;
+  s->poll_max = POLL_MAX;
+  s->backfill = 0;
+  return s;
+}
+
+void
+schedule_free(s)
+  schedule *s;
+{
+  int i;
+
+  for (i = 0; i < s->count; i++)
+    free(s->groups[i].name);
+  free(s->groups);
+  free(s);
+}
+
+/* add a group unless it's listed already; returns its entry */
+static schedule_group *
+schedule_add_group(s, name, len)
+  schedule *s;
+  const char *name;
+  size_t len;
+{
+  int i;
+  schedule_group *g;
+
+  for (i = 0; i < s->count; i++) {
+    if (strlen(s->groups[i].name) == len && memcmp(s->groups[i].name, name, len) == 0)
+      return &s->groups[i];
+  }
+
+  if (s->count == s->size) {
+    s->size = s->size == 0 ? 16 : s->size * 2;
+    g = (schedule_group *)realloc(s->groups, sizeof(schedule_group) * s->size);
+    if (g == NULL) {
+      perror("realloc");
+      return NULL;
+    }
+    s->groups = g;
+  }
+  g = &s->groups[s->count];
+  if ((g->name = strndup(name, len)) == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  g->group_id = 0;
+  g->low = g->high = 0;
+  g->known = 0;
+  g->next = 0;
+  g->backlog = 0;
+  g->first = g->history = 0;
+  g->polled = g->poll_at = 0;
+  g->interval = 0;
+  g->rate = 0;
+  s->count++;
+  return g;
+}
+
+int
+schedule_add(s, name, len)
+  schedule *s;
+  const char *name;
+  size_t len;
+{
+  return schedule_add_group(s, name, len) == NULL;
+}
+
+/* groups separated by commas or white space */
+int
+schedule_add_list(s, list)
+  schedule *s;
+  const char *list;
+{
+  size_t len;
+
+  while (*list) {
+    list += strspn(list, ", \t\r\n");
+    len = strcspn(list, ", \t\r\n");
+    if (len > 0 && schedule_add(s, list, len) != 0)
+      return 1;
+    list += len;
+  }
+  return 0;
+}
+
+/* one group per line; blank lines and anything after a # are skipped */
+int
+schedule_add_file(s, filename)
+  schedule *s;
+  const char *filename;
+{
+  FILE *f;
+  char line[1024];
+  int res = 0;
+
+  if ((f = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "Couldn't open group file %s.\n", filename);
+    return 1;
+  }
+  while (res == 0 && fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "#")] = 0;
+    res = schedule_add_list(s, line);
+  }
+  fclose(f);
+  return res;
+}
+
+typedef struct {
+  schedule *s;
+  int status;
+} schedule_active;
+
+/* one "<group> <high> <low> <status>\r\n" line of LIST ACTIVE */
+static void
+schedule_active_record(arg, rec, rlen)
+  void *arg;
+  const char *rec;
+  size_t rlen;
+{
+  schedule_active *a = (schedule_active *)arg;
+  schedule_group *g;
+  size_t len;
+  char *tail;
+
+  if (a->status != 0)
+    return;
+  len = strcspn(rec, " \t\r\n");
+  if (len == 0 || len >= rlen)
+    return;
+  if ((g = schedule_add_group(a->s, rec, len)) == NULL) {
+    a->status = 1;
+    return;
+  }
+  g->high = strtoll(rec + len, &tail, 10);
+  g->low = strtoll(tail, NULL, 10);
+  g->known = 1;
+}
+
+/* every group the server lists for a wildmat, with its marks */
+int
+schedule_add_active(s, n_conn, wildmat)
+  schedule *s;
+  nntp_conn *n_conn;
+  const char *wildmat;
+{
+  char cmd[1024];
+  const char *chunk;
+  size_t len;
+  int last = 0;
+  nntp_response *n_res;
+  schedule_active a;
+
+  snprintf(cmd, sizeof(cmd), "LIST ACTIVE %s\r\n", wildmat);
+  if (nntp_send(n_conn, cmd) != 0 || (n_res = nntp_receive_head(n_conn)) == NULL) {
+    return 1;
+  }
+  if (n_res->status != NNTP_LIST_OK) {
+    fprintf(stderr, "Couldn't list groups: %s %s\n", n_res->code, n_res->msg);
+    nntp_response_free(n_res);
+    return 1;
+  }
+  nntp_response_free(n_res);
+
+  a.s = s;
+  a.status = 0;
+  while (!last) {
+    if ((chunk = nntp_read_chunk(n_conn, &len, &last)) == NULL)
+      return 1;
+    nntp_records_feed(chunk, len, schedule_active_record, &a);
+  }
+  return a.status;
+}
+
+/* read the marks of groups that LIST ACTIVE didn't give us, sending the
+ * GROUP commands SCHEDULE_PIPELINE at a time */
+static int
+schedule_marks(s, n_conn)
+  schedule *s;
+  nntp_conn *n_conn;
+{
+  int i, j, n, len;
+  char cmd[SCHEDULE_PIPELINE * 512 + 1];
+  nntp_response *n_res;
+  nntp_group *n_group;
+
+  for (i = 0; i < s->count; i = j) {
+    for (j = i, n = 0, len = 0; j < s->count && n < SCHEDULE_PIPELINE; j++) {
+      if (s->groups[j].known)
+        continue;
+      if (strlen(s->groups[j].name) > 500) {
+        fprintf(stderr, "Skipping group %.40s...: name is too long\n", s->groups[j].name);
+        continue;
+      }
+      len += snprintf(cmd + len, sizeof(cmd) - len, "GROUP %s\r\n", s->groups[j].name);
+      n++;
+    }
+    if (n == 0)
+      continue;
+    if (nntp_send(n_conn, cmd) != 0)
+      return 1;
+
+    for (j = i; n > 0; j++) {
+      if (s->groups[j].known || strlen(s->groups[j].name) > 500)
+        continue;
+      n--;
+      if ((n_res = nntp_receive(n_conn)) == NULL)
+        return 1;
+      if (n_res->status == NNTP_GROUP_OK) {
+        n_group = (nntp_group *)n_res->data;
+        s->groups[j].low = n_group->low;
+        s->groups[j].high = n_group->high;
+        s->groups[j].known = 1;
+        nntp_group_free(n_group);
+      }
+      else {
+        fprintf(stderr, "Skipping group %s: %s %s\n", s->groups[j].name, n_res->code, n_res->msg);
+      }
+      nntp_response_free(n_res);
+    }
+  }
+  return 0;
+}
+
+static int
+schedule_cmp(a, b)
+  const void *a;
+  const void *b;
+{
+  const schedule_group *ga = (const schedule_group *)a, *gb = (const schedule_group *)b;
+
+  if (ga->backlog != gb->backlog)
+    return ga->backlog < gb->backlog ? 1 : -1;
+  return strcmp(ga->name, gb->name);
+}
+
+/* look up every group's marks and how far behind we are on it, and put
+ * the groups most behind first; groups the server doesn't have drop out.
+ * When backfilling, a group we have nothing of starts from its high mark
+ * and works down, and one we've started on carries on down from the
+ * lowest article we have. */
+int
+schedule_prepare(s, n_conn, db)
+  schedule *s;
+  nntp_conn *n_conn;
+  database *db;
+{
+  int i, n, res = 0;
+  long long article_id, first;
+  schedule_group *g;
+
+  if (schedule_marks(s, n_conn) != 0)
+    return 1;
+
+  for (i = 0, n = 0; i < s->count; i++) {
+    g = &s->groups[i];
+    if (!g->known) {
+      free(g->name);
+      continue;
+    }
+    if ((g->group_id = database_find_or_create_group(db, g->name)) < 0 ||
+        (article_id = database_last_article_id_for_group(db, g->group_id)) < 0 ||
+        (first = database_first_article_id_for_group(db, g->group_id)) < 0) {
+      res = 1;
+      break;
+    }
+    /* what expired before we got to it won't be fetched */
+    if (article_id > 0 && article_id + 1 < g->low &&
+        database_add_gap(db, g->group_id, article_id + 1, g->low - 1, "expired") != 0) {
+      res = 1;
+      break;
+    }
+    if (s->backfill && article_id == 0)
+      g->next = g->high + 1;
+    else
+      g->next = article_id == 0 || article_id < g->low ? g->low : article_id + 1;
+    g->backlog = g->high == 0 || g->high < g->low ? 0 : g->high - g->next + 1;
+    if (g->backlog < 0)
+      g->backlog = 0;
+    g->first = s->backfill && article_id == 0 ? g->next : first > 0 ? first : g->low;
+    g->history = s->backfill && g->high != 0 && g->first > g->low ? g->first - g->low : 0;
+    s->groups[n++] = *g;
+  }
+  /* on failure the groups not yet looked at are kept after those that
+   * were, so that schedule_free() frees every name once */
+  if (res != 0) {
+    memmove(&s->groups[n], &s->groups[i], sizeof(schedule_group) * (s->count - i));
+    n += s->count - i;
+  }
+  s->count = n;
+  if (res != 0)
+    return 1;
+
+  qsort(s->groups, s->count, sizeof(schedule_group), schedule_cmp);
+  return 0;
+}
+
+/* start polling every group, poll_min seconds from now */
+void
+schedule_start(s, poll_min, poll_max)
+  schedule *s;
+  int poll_min;
+  int poll_max;
+{
+  int i;
+  time_t now = time(NULL);
+
+  s->poll_min = poll_min;
+  s->poll_max = poll_max < poll_min ? poll_min : poll_max;
+  for (i = 0; i < s->count; i++) {
+    s->groups[i].polled = now;
+    s->groups[i].interval = s->poll_min;
+    s->groups[i].poll_at = now + s->poll_min;
+    s->groups[i].rate = 0;
+  }
+}
+
+/* the group to poll next */
+schedule_group *
+schedule_due(s)
+  schedule *s;
+{
+  int i;
+  schedule_group *g = NULL;
+
+  for (i = 0; i < s->count; i++) {
+    if (g == NULL || s->groups[i].poll_at < g->poll_at)
+      g = &s->groups[i];
+  }
+  return g;
+}
+
+/* the group with the most history left to backfill, if any */
+schedule_group *
+schedule_backfill(s)
+  schedule *s;
+{
+  int i;
+  schedule_group *g = NULL;
+
+  for (i = 0; i < s->count; i++) {
+    if (s->groups[i].history > 0 && (g == NULL || s->groups[i].history > g->history))
+      g = &s->groups[i];
+  }
+  return g;
+}
+
+/* take a group's new marks, and set its next poll so that it would find
+ * about POLL_TARGET articles at the rate they've been turning up */
+void
+schedule_update(s, g, low, high)
+  schedule *s;
+  schedule_group *g;
+  long long low;
+  long long high;
+{
+  time_t now = time(NULL);
+  double elapsed, seen;
+  long long interval;
+
+  elapsed = now > g->polled ? (double)(now - g->polled) : 1.0;
+  seen = high > g->high ? (double)(high - g->high) : 0.0;
+  g->rate = g->rate == 0 ? seen / elapsed : 0.75 * g->rate + 0.25 * seen / elapsed;
+
+  interval = g->rate > 0 ? (long long)(POLL_TARGET / g->rate) : (long long)g->interval * 2;
+  if (interval < s->poll_min)
+    interval = s->poll_min;
+  if (interval > s->poll_max)
+    interval = s->poll_max;
+  g->interval = (int)interval;
+  g->polled = now;
+  g->poll_at = now + g->interval;
+
+  g->low = low;
+  if (high > g->high)
+    g->high = high;
+  if (g->next < g->low)
+    g->next = g->low;
+  g->backlog = g->high >= g->next ? g->high - g->next + 1 : 0;
+  g->history = s->backfill && g->high != 0 && g->first > g->low ? g->first - g->low : 0;
+}
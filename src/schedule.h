@@ -0,0 +1,57 @@
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#include <time.h>
+#include "conn.h"
+#include "database.h"
+
+/* GROUP commands sent per write when looking up marks */
+#define SCHEDULE_PIPELINE 64
+/* daemon polling: seconds between GROUP commands for a group, and the
+ * number of new articles we'd like each poll to find */
+#define POLL_MIN 10
+#define POLL_MAX 900
+#define POLL_TARGET 100
+/* articles backfilled per turn at a group, so that new articles and the
+ * other groups don't wait on years of history */
+#define BACKFILL_CHUNK 250000
+
+typedef struct {
+  char *name;
+  long long group_id;
+  long long low;            /* the server's marks */
+  long long high;
+  int known;                /* low and high have been read */
+  long long next;           /* first article to fetch */
+  long long backlog;        /* articles from next to high */
+  long long first;          /* lowest article stored, when backfilling */
+  long long history;        /* articles from low to first left to backfill */
+  time_t polled;            /* when high was last read */
+  time_t poll_at;           /* when to read it again */
+  int interval;             /* seconds between polls */
+  double rate;              /* new articles per second, smoothed */
+} schedule_group;
+
+/* the groups to crawl, most behind first once prepared */
+typedef struct {
+  schedule_group *groups;
+  int count;
+  int size;
+  int poll_min;             /* bounds on the poll interval */
+  int poll_max;
+  int backfill;             /* crawl new groups newest first */
+} schedule;
+
+schedule *schedule_new();
+void schedule_free(schedule *);
+int schedule_add(schedule *, const char *, size_t);
+int schedule_add_list(schedule *, const char *);
+int schedule_add_file(schedule *, const char *);
+int schedule_add_active(schedule *, nntp_conn *, const char *);
+int schedule_prepare(schedule *, nntp_conn *, database *);
+void schedule_start(schedule *, int, int);
+schedule_group *schedule_due(schedule *);
+schedule_group *schedule_backfill(schedule *);
+void schedule_update(schedule *, schedule_group *, long long, long long);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include "session.h"
+#include "stats.h"
+
+/* set up openssl; ca_file, if given, holds the certificates to trust
+ * instead of the system's */
+void
+nntp_init(ca_file)
+  const char *ca_file;
+{
+  nntp_conn_trust(ca_file);
+  SSL_library_init();
+  SSL_load_error_strings();
+  ERR_load_BIO_strings();
+  OpenSSL_add_all_algorithms();
+}
+
+/* connect to server and authenticate; returns NULL on failure */
+nntp_conn *
+nntp_login(server, user, password)
+  const char *server;
+  const char *user;
+  const char *password;
+{
+  char cmd[1024];
+  nntp_conn *n_conn;
+  nntp_response *n_res;
+  double start;
+
+  start = stats_clock();
+  if ((n_conn = nntp_conn_new(server)) == NULL) {
+    return NULL;
+  }
+  stats_time(stat_connect, stats_clock() - start);
+  start = stats_clock();
+  if ((n_res = nntp_receive(n_conn)) == NULL) {
+    nntp_conn_free(n_conn);
+    return NULL;
+  }
+  if (n_res->status != NNTP_OK) {
+    fprintf(stderr, "Status wasn't OK.\n");
+    nntp_shutdown(n_conn, n_res);
+    return NULL;
+  }
+  nntp_response_free(n_res);
+
+  /* authentication */
+  snprintf(cmd, sizeof(cmd), "AUTHINFO USER %s\r\n", user);
+  nntp_send(n_conn, cmd);
+  if ((n_res = nntp_receive(n_conn)) == NULL) {
+    nntp_conn_free(n_conn);
+    return NULL;
+  }
+  if (n_res->status == NNTP_PASS_REQUIRED) {
+    snprintf(cmd, sizeof(cmd), "AUTHINFO PASS %s\r\n", password);
+    nntp_send(n_conn, cmd);
+    nntp_response_free(n_res);
+    if ((n_res = nntp_receive(n_conn)) == NULL) {
+      nntp_conn_free(n_conn);
+      return NULL;
+    }
+  }
+  if (n_res->status != NNTP_AUTH_OK) {
+    fprintf(stderr, "Authentication was unsuccessful.\n");
+    nntp_shutdown(n_conn, n_res);
+    return NULL;
+  }
+  nntp_response_free(n_res);
+  stats_time(stat_auth, stats_clock() - start);
+
+  return n_conn;
+}
+
+/* select group; returns its info, or NULL on failure */
+nntp_group *
+nntp_select_group(n_conn, group)
+  nntp_conn *n_conn;
+  const char *group;
+{
+  char cmd[1024];
+  nntp_group *n_group = NULL;
+  nntp_response *n_res;
+  double start;
+
+  start = stats_clock();
+  snprintf(cmd, sizeof(cmd), "GROUP %s\r\n", group);
+  nntp_send(n_conn, cmd);
+  if ((n_res = nntp_receive(n_conn)) == NULL) {
+    return NULL;
+  }
+  stats_time(stat_group, stats_clock() - start);
+  if (n_res->status == NNTP_GROUP_OK) {
+    n_group = (nntp_group *)n_res->data;
+  }
+  else {
+    fprintf(stderr, "Group command wasn't successful.\n");
+  }
+  nntp_response_free(n_res);
+
+  return n_group;
+}
+
+void
+nntp_shutdown(n_conn, n_res)
+  nntp_conn *n_conn;
+  nntp_response *n_res;
+{
+  if (n_res != NULL)
+    nntp_response_free(n_res);
+
+  if (n_conn == NULL)
+    return;
+
+  nntp_send(n_conn, "QUIT\r\n");
+  n_res = nntp_receive(n_conn);
+  if (n_res != NULL)
+    nntp_response_free(n_res);
+
+  nntp_conn_free(n_conn);
+}
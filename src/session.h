@@ -0,0 +1,13 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include "conn.h"
+#include "group.h"
+#include "response.h"
+
+void nntp_init(const char *);
+nntp_conn *nntp_login(const char *, const char *, const char *);
+nntp_group *nntp_select_group(nntp_conn *, const char *);
+void nntp_shutdown(nntp_conn *, nntp_response *);
+
+#endif
@@ -1,5 +1,9 @@
 #include "sqlite.h"
+#include "hash.h"
+#include "bloom.h"
 
+/* make the statement of the given type current; statements other than
+ * tmp_stmt are prepared once and kept for the life of the connection */
 int
 database_sqlite_prepare(db, stmt_type, sql)
   database *db;
@@ -7,18 +11,30 @@ database_sqlite_prepare(db, stmt_type, sql)
   const char *sql;
 {
   int res;
-  if (stmt_type == tmp_stmt || db->stmt_type != stmt_type) {
-    if (db->stmt_type != blank_stmt)
-      sqlite3_finalize((sqlite3_stmt *)db->s_stmt);
+  sqlite3_stmt **stmt = (sqlite3_stmt **)&db->s_stmts[stmt_type];
 
-    res = sqlite3_prepare_v2((sqlite3 *)db->s_db, sql, -1, (sqlite3_stmt **)&db->s_stmt, NULL);
+  if (*stmt != NULL && stmt_type == tmp_stmt) {
+    sqlite3_finalize(*stmt);
+    *stmt = NULL;
+  }
+
+  if (*stmt == NULL) {
+    res = sqlite3_prepare_v2((sqlite3 *)db->s_db, sql, -1, stmt, NULL);
     if (res != SQLITE_OK) {
       fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      *stmt = NULL;
+      db->s_stmt = NULL;
       db->stmt_type = blank_stmt;
       return 1;
     }
-    db->stmt_type = stmt_type;
   }
+  else {
+    sqlite3_reset(*stmt);
+    sqlite3_clear_bindings(*stmt);
+  }
+
+  db->s_stmt = *stmt;
+  db->stmt_type = stmt_type;
   return 0;
 }
 
@@ -26,24 +42,28 @@ database *
 database_sqlite_open(filename)
   const char *filename;
 {
-  int migrate, res;
+  int create, res;
   database *db;
   FILE *f;
 
   db = (database *)malloc(sizeof(database));
   db->s_db = NULL;
   db->s_stmt = NULL;
+  memset(db->s_stmts, 0, sizeof(db->s_stmts));
   db->stmt_type = blank_stmt;
   db->db_type = sqlite;
+  db->date_text = 1;
+  db->message_ids = NULL;
+  db->posters = NULL;
 
   /* open the sqlite database */
   if ((f = fopen(filename, "r")) != NULL) {
-    migrate = 0;
+    create = 0;
     fclose(f);
   }
   else if (errno == ENOENT) {
     /* schema needs to be created */
-    migrate = 1;
+    create = 1;
   }
   else {
     fprintf(stderr, "Couldn't open database: %s\n", strerror(errno));
@@ -61,35 +81,180 @@ database_sqlite_open(filename)
   fprintf(stderr, "Opened database: %s\n", filename);
 #endif
 
-  /* create schema if necessary */
-  if (migrate) {
-    res = sqlite3_exec((sqlite3 *)db->s_db, "CREATE TABLE groups (id INTEGER PRIMARY KEY, name TEXT, last_article_id INTEGER)", NULL, NULL, NULL);
-    if (res == 0) {
-      res = sqlite3_exec((sqlite3 *)db->s_db, "CREATE TABLE articles (id INTEGER PRIMARY KEY, article_id INTEGER, group_id INTEGER, subject TEXT, message_id TEXT, poster TEXT, posted_at TEXT, bytes INTEGER)", NULL, NULL, NULL);
-    }
-    if (res == 0) {
-      res = sqlite3_exec((sqlite3 *)db->s_db, "CREATE INDEX articles_article_id ON articles (article_id)", NULL, NULL, NULL);
-    }
-    if (res != 0) {
+  /* create schema if necessary, or bring it up to date */
+  if (create) {
+    if (database_sqlite_create_schema(db) != 0) {
       database_close(db);
-      fprintf(stderr, "Couldn't create schema: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
       return NULL;
     }
+    if (database_sqlite_create_search_index(db) != 0) {
+      fprintf(stderr, "Continuing without search indexes.\n");
+    }
+  }
+  else if (database_sqlite_migrate(db) != 0) {
+    database_close(db);
+    return NULL;
   }
 
   return db;
 }
 
+/* whether the schema has a table of that name: 1 if so, 0 if not, -1 on
+ * failure */
+int
+database_sqlite_has_table(db, name)
+  database *db;
+  const char *name;
+{
+  int res;
+  sqlite3_stmt *stmt;
+
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db, "SELECT 1 FROM sqlite_master WHERE name = ?", -1, &stmt, NULL);
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return -1;
+  }
+  sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+  res = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  return res == SQLITE_ROW;
+}
+
+/* create a search index unless it is there already */
+static int
+database_sqlite_create_index(db, name, sql)
+  database *db;
+  const char *name;
+  const char *sql;
+{
+  int res;
+
+  if ((res = database_sqlite_has_table(db, name)) != 0)
+    return res < 0;
+
+  res = sqlite3_exec((sqlite3 *)db->s_db, sql, NULL, NULL, NULL);
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't create search index %s: %s\n", name, sqlite3_errmsg((sqlite3 *)db->s_db));
+    sqlite3_exec((sqlite3 *)db->s_db, "ROLLBACK", NULL, NULL, NULL);
+    return 1;
+  }
+  return 0;
+}
+
+/* full-text (trigram) indexes on article subjects and file names, kept
+ * up to date by triggers; they are built from the existing rows when
+ * first created */
+int
+database_sqlite_create_search_index(db)
+  database *db;
+{
+  if (database_sqlite_create_index(db, "articles_search",
+        "BEGIN;"
+        "CREATE VIRTUAL TABLE articles_search USING fts5(subject, content='articles', content_rowid='id', tokenize='trigram');"
+        SEARCH_INDEX_TRIGGERS
+        "INSERT INTO articles_search (articles_search) VALUES ('rebuild');"
+        "COMMIT;") != 0)
+    return 1;
+  return database_sqlite_create_index(db, "files_search",
+      "BEGIN;"
+      "CREATE VIRTUAL TABLE files_search USING fts5(name, content='files', content_rowid='id', tokenize='trigram');"
+      FILES_SEARCH_TRIGGERS
+      "INSERT INTO files_search (files_search) VALUES ('rebuild');"
+      "COMMIT;");
+}
+
+/* fill a bloom filter with every stored Message-ID, sized for twice as
+ * many as there are now */
+static int
+database_sqlite_load_message_ids(db)
+  database *db;
+{
+  int res;
+  bloom *b;
+  sqlite3_stmt *stmt;
+
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db, "SELECT count(*) FROM articles", -1, &stmt, NULL);
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return 1;
+  }
+  res = sqlite3_step(stmt);
+  b = bloom_new(res == SQLITE_ROW ? (size_t)sqlite3_column_int64(stmt, 0) * 2 : 0);
+  sqlite3_finalize(stmt);
+  if (b == NULL) {
+    return 1;
+  }
+
+  res = sqlite3_prepare_v2((sqlite3 *)db->s_db, "SELECT message_id FROM articles", -1, &stmt, NULL);
+  if (res != SQLITE_OK) {
+    fprintf(stderr, "Couldn't prepare statement: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    bloom_free(b);
+    return 1;
+  }
+  while ((res = sqlite3_step(stmt)) == SQLITE_ROW)
+    bloom_add(b, (const char *)sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+  sqlite3_finalize(stmt);
+  if (res != SQLITE_DONE) {
+    fprintf(stderr, "Couldn't load message ids: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    bloom_free(b);
+    return 1;
+  }
+
+  bloom_free((bloom *)db->message_ids);
+  db->message_ids = b;
+  return 0;
+}
+
 void
 database_sqlite_close(db)
   database *db;
 {
-  if (db->stmt_type != blank_stmt)
-    sqlite3_finalize((sqlite3_stmt *)db->s_stmt);
+  int i;
+
+  for (i = 0; i < num_stmt_types; i++) {
+    if (db->s_stmts[i] != NULL)
+      sqlite3_finalize((sqlite3_stmt *)db->s_stmts[i]);
+  }
+  bloom_free((bloom *)db->message_ids);
+  if (db->posters != NULL)
+    hash_free((hash *)db->posters, free);
   sqlite3_close((sqlite3 *)db->s_db);
   free(db);
 }
 
+int
+database_sqlite_configure(db, wal, synchronous, cache_size, date_text)
+  database *db;
+  int wal;
+  const char *synchronous;
+  int cache_size;
+  int date_text;
+{
+  char sql[256];
+
+  db->date_text = date_text;
+
+  if (wal && sqlite3_exec((sqlite3 *)db->s_db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Couldn't switch to WAL: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return 1;
+  }
+  if (synchronous != NULL) {
+    snprintf(sql, sizeof(sql), "PRAGMA synchronous = %s", synchronous);
+    if (sqlite3_exec((sqlite3 *)db->s_db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+      fprintf(stderr, "Couldn't set synchronous: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      return 1;
+    }
+  }
+  if (cache_size != 0) {
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = %d", cache_size);
+    if (sqlite3_exec((sqlite3 *)db->s_db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+      fprintf(stderr, "Couldn't set cache size: %s\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      return 1;
+    }
+  }
+  return 0;
+}
+
 long long
 database_sqlite_find_or_create_group(db, group)
   database *db;
@@ -99,7 +264,7 @@ database_sqlite_find_or_create_group(db, group)
   long long group_id;
 
   /* find or create group; find last article id that we know about */
-  res = database_sqlite_prepare(db, tmp_stmt, "SELECT id FROM groups WHERE name = ?");
+  res = database_sqlite_prepare(db, find_group_stmt, "SELECT id FROM groups WHERE name = ?");
   if (res > 0) {
     return -1;
   }
@@ -107,10 +272,11 @@ database_sqlite_find_or_create_group(db, group)
   res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
   if (res == SQLITE_ROW) {
     group_id = (long long) sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0);
+    sqlite3_reset((sqlite3_stmt *)db->s_stmt);
   }
   else {
     /* create group */
-    res = database_sqlite_prepare(db, tmp_stmt, "INSERT INTO groups (name) VALUES (?)");
+    res = database_sqlite_prepare(db, create_group_stmt, "INSERT INTO groups (name) VALUES (?)");
     if (res > 0) {
       return -1;
     }
@@ -136,7 +302,7 @@ database_sqlite_last_article_id_for_group(db, group_id)
   int res;
   long long article_id;
 
-  res = database_sqlite_prepare(db, tmp_stmt, "SELECT last_article_id FROM groups WHERE id = ?");
+  res = database_sqlite_prepare(db, last_article_id_stmt, "SELECT last_article_id FROM groups WHERE id = ?");
   if (res > 0) {
     return -1;
   }
@@ -144,6 +310,7 @@ database_sqlite_last_article_id_for_group(db, group_id)
 
   res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
   article_id = (long long) (res == SQLITE_ROW ? sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0) : 0);
+  sqlite3_reset((sqlite3_stmt *)db->s_stmt);
 
   return article_id;
 }
@@ -188,29 +355,80 @@ database_sqlite_commit(db)
   return 0;
 }
 
+/* bind an article's columns starting at parameter i */
+static void
+database_sqlite_bind_article(db, i, a)
+  database *db;
+  int i;
+  article *a;
+{
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i, a->article_id);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i + 1, a->group_id);
+  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, i + 2, a->subject, a->slen, SQLITE_STATIC);
+  /* NULL rather than empty, so that the unique index lets it repeat */
+  if (a->mlen > 0)
+    sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, i + 3, a->message_id, a->mlen, SQLITE_STATIC);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i + 4, a->poster_id);
+  if (db->date_text)
+    sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, i + 5, a->posted_at, a->wlen, SQLITE_STATIC);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i + 6, a->bytes);
+  if (a->file_id > 0) {
+    sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i + 7, a->file_id);
+    sqlite3_bind_int((sqlite3_stmt *)db->s_stmt, i + 8, a->part);
+  }
+  if (a->posted != 0)
+    sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, i + 9, a->posted);
+}
+
+/* map an article number to the stored article with its Message-ID */
+static int
+database_sqlite_link_posting(db, a)
+  database *db;
+  article *a;
+{
+  int res;
+
+  res = database_sqlite_prepare(db, link_posting_stmt,
+      "INSERT OR IGNORE INTO postings (group_id, article_id, article) SELECT ?, ?, id FROM articles WHERE message_id = ?");
+  if (res > 0) {
+    return 1;
+  }
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, a->group_id);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 2, a->article_id);
+  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 3, a->message_id, a->mlen, SQLITE_STATIC);
+  while ((res = sqlite3_step((sqlite3_stmt *)db->s_stmt)) == SQLITE_BUSY) {
+    fprintf(stderr, "Database is busy.  Sleeping...\n");
+    sleep(1);
+  }
+  if (res != SQLITE_DONE) {
+    fprintf(stderr, "Couldn't add posting (%s)\n  article_id: %lld, group_id: %lld\n", sqlite3_errmsg((sqlite3 *)db->s_db), a->article_id, a->group_id);
+    sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+    return 1;
+  }
+  return 0;
+}
+
 long long
 database_sqlite_insert_article(db, a)
   database *db;
   article *a;
 {
   int res;
-  res = database_sqlite_prepare(db, insert_article_stmt, "INSERT INTO articles (article_id, group_id, subject, message_id, poster, posted_at, bytes) VALUES (?, ?, ?, ?, ?, ?, ?)");
+  res = database_sqlite_prepare(db, insert_article_stmt, "INSERT OR IGNORE INTO articles (article_id, group_id, subject, message_id, poster_id, posted_at, bytes, file_id, part, posted) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
   if (res > 0) {
     return -1;
   }
 
-  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, a->article_id);
-  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 2, a->group_id);
-  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 3, a->subject, a->slen, SQLITE_STATIC);
-  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 4, a->message_id, a->mlen, SQLITE_STATIC);
-  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 5, a->poster, a->plen, SQLITE_STATIC);
-  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 6, a->posted_at, a->wlen, SQLITE_STATIC);
-  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 7, a->bytes);
+  database_sqlite_bind_article(db, 1, a);
   while (1) {
     res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
     if (res == SQLITE_DONE) {
       sqlite3_reset((sqlite3_stmt *)db->s_stmt);
       sqlite3_clear_bindings((sqlite3_stmt *)db->s_stmt);
+      if (sqlite3_changes((sqlite3 *)db->s_db) == 0) {
+        /* stored meanwhile by someone else */
+        return database_sqlite_link_posting(db, a) == 0 ? 0 : -1;
+      }
       return (long long) sqlite3_last_insert_rowid((sqlite3 *)db->s_db);
     }
     else if (res == SQLITE_BUSY) {
@@ -224,6 +442,386 @@ database_sqlite_insert_article(db, a)
   }
 }
 
+/* insert articles INSERT_ROWS to a statement, and the rest one by one */
+static int
+database_sqlite_insert_rows(db, a, count)
+  database *db;
+  article *a;
+  int count;
+{
+  int i, j, res, n = 0;
+  size_t len;
+  char sql[256 + INSERT_ROWS * 40];
+
+  while (count - n >= INSERT_ROWS) {
+    if (db->s_stmts[insert_articles_stmt] == NULL) {
+      len = snprintf(sql, sizeof(sql), "INSERT OR IGNORE INTO articles (article_id, group_id, subject, message_id, poster_id, posted_at, bytes, file_id, part, posted) VALUES ");
+      for (i = 0; i < INSERT_ROWS; i++)
+        len += snprintf(sql + len, sizeof(sql) - len, "%s(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)", i == 0 ? "" : ", ");
+    }
+    if (database_sqlite_prepare(db, insert_articles_stmt, sql) > 0) {
+      return n;
+    }
+
+    for (i = 0, j = 1; i < INSERT_ROWS; i++, j += 10)
+      database_sqlite_bind_article(db, j, &a[n + i]);
+    while (1) {
+      res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+      if (res == SQLITE_DONE) {
+        sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+        sqlite3_clear_bindings((sqlite3_stmt *)db->s_stmt);
+        break;
+      }
+      else if (res == SQLITE_BUSY) {
+        fprintf(stderr, "Database is busy.  Sleeping...\n");
+        sleep(1);
+      }
+      else {
+        fprintf(stderr, "Couldn't insert rows (%s)\n  article_id: %lld-%lld, group_id: %lld\n", sqlite3_errmsg((sqlite3 *)db->s_db), a[n].article_id, a[n + INSERT_ROWS - 1].article_id, a[n].group_id);
+        sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+        return n;
+      }
+    }
+    if (sqlite3_changes((sqlite3 *)db->s_db) < INSERT_ROWS) {
+      /* some were stored meanwhile by someone else */
+      for (i = 0; i < INSERT_ROWS; i++) {
+        if (database_sqlite_link_posting(db, &a[n + i]) != 0)
+          return n;
+      }
+    }
+    n += INSERT_ROWS;
+  }
+
+  for (; n < count; n++) {
+    if (database_sqlite_insert_article(db, &a[n]) < 0)
+      break;
+  }
+  return n;
+}
+
+typedef struct {
+  long long id;
+  int parts;
+  long long bytes;
+} file_count;
+
+/* find or create the file of every article with a part counter, setting
+ * its file_id; file[i] is the index in counts of a[i]'s file, or -1.
+ * Returns the number of files, or -1. */
+static int
+database_sqlite_find_files(db, a, count, file, counts)
+  database *db;
+  article *a;
+  int count;
+  int *file;
+  file_count *counts;
+{
+  int i, res, n = 0;
+  size_t klen, size = 0;
+  char *key = NULL, *k;
+  void **slot;
+  hash *h;
+
+  if ((h = hash_new(count / 8)) == NULL)
+    return -1;
+
+  for (i = 0; i < count; i++) {
+    file[i] = -1;
+    a[i].file_id = 0;
+    if (a[i].nlen == 0)
+      continue;
+
+    /* files are told apart by group, name and total */
+    klen = sizeof(long long) + sizeof(int) + a[i].nlen;
+    if (klen > size) {
+      size = klen * 2;
+      if ((k = (char *)realloc(key, size)) == NULL) {
+        perror("realloc");
+        n = -1;
+        break;
+      }
+      key = k;
+    }
+    memcpy(key, &a[i].group_id, sizeof(long long));
+    memcpy(key + sizeof(long long), &a[i].total, sizeof(int));
+    memcpy(key + sizeof(long long) + sizeof(int), a[i].subject, a[i].nlen);
+    if ((slot = hash_lookup(h, key, klen, 1)) == NULL) {
+      n = -1;
+      break;
+    }
+    if (*slot != NULL) {
+      file[i] = (file_count *)*slot - counts;
+      a[i].file_id = counts[file[i]].id;
+      continue;
+    }
+
+    res = database_sqlite_prepare(db, find_file_stmt,
+        "INSERT INTO files (group_id, name, total_parts, parts, bytes) VALUES (?, ?, ?, 0, 0) "
+        "ON CONFLICT (group_id, name, total_parts) DO UPDATE SET parts = parts RETURNING id");
+    if (res > 0) {
+      n = -1;
+      break;
+    }
+    sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, a[i].group_id);
+    sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 2, a[i].subject, a[i].nlen, SQLITE_STATIC);
+    sqlite3_bind_int((sqlite3_stmt *)db->s_stmt, 3, a[i].total);
+    while ((res = sqlite3_step((sqlite3_stmt *)db->s_stmt)) == SQLITE_BUSY) {
+      fprintf(stderr, "Database is busy.  Sleeping...\n");
+      sleep(1);
+    }
+    if (res != SQLITE_ROW) {
+      fprintf(stderr, "Couldn't find file (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+      n = -1;
+      break;
+    }
+    counts[n].id = (long long) sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0);
+    counts[n].parts = 0;
+    counts[n].bytes = 0;
+    sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+
+    *slot = &counts[n];
+    file[i] = n++;
+    a[i].file_id = counts[file[i]].id;
+  }
+
+  free(key);
+  hash_free(h, NULL);
+  return n;
+}
+
+/* add the parts and bytes of the inserted articles to their files */
+static int
+database_sqlite_count_files(db, a, count, file, counts, num_files)
+  database *db;
+  article *a;
+  int count;
+  int *file;
+  file_count *counts;
+  int num_files;
+{
+  int i, res;
+
+  for (i = 0; i < count; i++) {
+    if (file[i] >= 0) {
+      counts[file[i]].parts++;
+      counts[file[i]].bytes += a[i].bytes;
+    }
+  }
+
+  for (i = 0; i < num_files; i++) {
+    if (counts[i].parts == 0)
+      continue;
+    res = database_sqlite_prepare(db, count_file_stmt, "UPDATE files SET parts = parts + ?, bytes = bytes + ? WHERE id = ?");
+    if (res > 0) {
+      return 1;
+    }
+    sqlite3_bind_int((sqlite3_stmt *)db->s_stmt, 1, counts[i].parts);
+    sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 2, counts[i].bytes);
+    sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 3, counts[i].id);
+    while ((res = sqlite3_step((sqlite3_stmt *)db->s_stmt)) == SQLITE_BUSY) {
+      fprintf(stderr, "Database is busy.  Sleeping...\n");
+      sleep(1);
+    }
+    if (res != SQLITE_DONE) {
+      fprintf(stderr, "Couldn't update file (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* set the poster_id of count articles, adding new posters; the ids of
+ * the last POSTER_CACHE or so posters are kept in memory */
+static int
+database_sqlite_find_posters(db, a, count)
+  database *db;
+  article *a;
+  int count;
+{
+  int i, res;
+  long long *id;
+  void **slot;
+
+  for (i = 0; i < count; i++) {
+    if (db->posters != NULL && ((hash *)db->posters)->count >= POSTER_CACHE) {
+      hash_free((hash *)db->posters, free);
+      db->posters = NULL;
+    }
+    if (db->posters == NULL && (db->posters = hash_new(POSTER_CACHE)) == NULL)
+      return 1;
+    if ((slot = hash_lookup((hash *)db->posters, a[i].poster, a[i].plen, 1)) == NULL)
+      return 1;
+    if (*slot != NULL) {
+      a[i].poster_id = *(long long *)*slot;
+      continue;
+    }
+
+    res = database_sqlite_prepare(db, find_poster_stmt, "SELECT id FROM posters WHERE name = ?");
+    if (res > 0) {
+      return 1;
+    }
+    sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 1, a[i].poster, a[i].plen, SQLITE_STATIC);
+    res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+    if (res == SQLITE_ROW) {
+      a[i].poster_id = (long long) sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0);
+      sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+    }
+    else {
+      sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+      res = database_sqlite_prepare(db, create_poster_stmt, "INSERT INTO posters (name) VALUES (?)");
+      if (res > 0) {
+        return 1;
+      }
+      sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 1, a[i].poster, a[i].plen, SQLITE_STATIC);
+      while ((res = sqlite3_step((sqlite3_stmt *)db->s_stmt)) == SQLITE_BUSY) {
+        fprintf(stderr, "Database is busy.  Sleeping...\n");
+        sleep(1);
+      }
+      sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+      if (res != SQLITE_DONE) {
+        fprintf(stderr, "Couldn't create poster (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+        return 1;
+      }
+      a[i].poster_id = (long long) sqlite3_last_insert_rowid((sqlite3 *)db->s_db);
+    }
+
+    if ((id = (long long *)malloc(sizeof(long long))) == NULL) {
+      perror("malloc");
+      return 1;
+    }
+    *id = a[i].poster_id;
+    *slot = id;
+  }
+  return 0;
+}
+
+/* is an article with this Message-ID stored already, or among the count
+ * new ones in fresh?  1 if so, 0 if not, -1 on failure.  The bloom filter
+ * answers most of these; repeats within a batch are rare enough to look
+ * for one by one. */
+static int
+database_sqlite_stored(db, a, fresh, count)
+  database *db;
+  article *a;
+  article *fresh;
+  int count;
+{
+  int i, res;
+
+  /* without a Message-ID there's nothing to tell it's a copy */
+  if (a->mlen == 0)
+    return 0;
+  if (!bloom_check((bloom *)db->message_ids, a->message_id, a->mlen))
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    if (fresh[i].mlen == a->mlen && memcmp(fresh[i].message_id, a->message_id, a->mlen) == 0)
+      return 1;
+  }
+
+  res = database_sqlite_prepare(db, find_message_id_stmt, "SELECT 1 FROM articles WHERE message_id = ?");
+  if (res > 0) {
+    return -1;
+  }
+  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 1, a->message_id, a->mlen, SQLITE_STATIC);
+  res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+  sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+  if (res != SQLITE_ROW && res != SQLITE_DONE) {
+    fprintf(stderr, "Couldn't look up message id (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return -1;
+  }
+  return res == SQLITE_ROW;
+}
+
+/* insert the articles that aren't stored yet, linking each one with a
+ * part counter to its file; the others (crossposts, and repeats within
+ * the batch) only get a posting pointing at the stored one.  Returns how
+ * many of a were handled, in order. */
+static int
+database_sqlite_insert_new(db, a, count, fresh, pos, dups, file, counts)
+  database *db;
+  article *a;
+  int count;
+  article *fresh;
+  int *pos;
+  int *dups;
+  int *file;
+  file_count *counts;
+{
+  int i, n, num_new = 0, num_dups = 0, num_files;
+  bloom *b = (bloom *)db->message_ids;
+
+  for (i = 0; i < count; i++) {
+    switch (database_sqlite_stored(db, &a[i], fresh, num_new)) {
+      case 0:
+        bloom_add(b, a[i].message_id, a[i].mlen);
+        pos[num_new] = i;
+        fresh[num_new++] = a[i];
+        break;
+      case 1:
+        dups[num_dups++] = i;
+        break;
+      default:
+        count = i;
+    }
+  }
+
+  if (database_sqlite_find_posters(db, fresh, num_new) != 0)
+    return 0;
+  if ((num_files = database_sqlite_find_files(db, fresh, num_new, file, counts)) < 0)
+    return 0;
+  n = database_sqlite_insert_rows(db, fresh, num_new);
+  if (database_sqlite_count_files(db, fresh, n, file, counts, num_files) != 0)
+    fprintf(stderr, "Part counts of files in articles %lld-%lld are off.\n", a[0].article_id, a[count - 1].article_id);
+  for (i = 0; i < n; i++)
+    a[pos[i]].file_id = fresh[i].file_id;
+  n = n < num_new ? pos[n] : count;
+
+  for (i = 0; i < num_dups && dups[i] < n; i++) {
+    if (database_sqlite_link_posting(db, &a[dups[i]]) != 0)
+      return dups[i];
+  }
+#ifdef DEBUG
+  fprintf(stderr, "Inserted %d articles, %d already stored.\n", num_new, num_dups);
+#endif
+  return n;
+}
+
+int
+database_sqlite_insert_articles(db, a, count)
+  database *db;
+  article *a;
+  int count;
+{
+  int n = 0, *file, *dups, *pos;
+  file_count *counts;
+  article *fresh;
+
+  if (db->message_ids == NULL || ((bloom *)db->message_ids)->count > ((bloom *)db->message_ids)->capacity) {
+    if (database_sqlite_load_message_ids(db) != 0)
+      return 0;
+  }
+
+  file = (int *)malloc(sizeof(int) * count);
+  counts = (file_count *)malloc(sizeof(file_count) * count);
+  fresh = (article *)malloc(sizeof(article) * count);
+  dups = (int *)malloc(sizeof(int) * count);
+  pos = (int *)malloc(sizeof(int) * count);
+  if (file == NULL || counts == NULL || fresh == NULL || dups == NULL || pos == NULL)
+    perror("malloc");
+  else
+    n = database_sqlite_insert_new(db, a, count, fresh, pos, dups, file, counts);
+
+  free(file);
+  free(counts);
+  free(fresh);
+  free(dups);
+  free(pos);
+  return n;
+}
+
 int
 database_sqlite_group_set_last_article_id(db, group_id, article_id)
   database *db;
@@ -231,7 +829,8 @@ database_sqlite_group_set_last_article_id(db, group_id, article_id)
   long long article_id;
 {
   int res;
-  res = database_sqlite_prepare(db, tmp_stmt, "UPDATE groups SET last_article_id = ? WHERE id = ?");
+  res = database_sqlite_prepare(db, set_last_article_id_stmt,
+      "UPDATE groups SET last_article_id = max(coalesce(last_article_id, 0), ?) WHERE id = ?");
   if (res > 0) {
     return -1;
   }
@@ -252,3 +851,162 @@ database_sqlite_group_set_last_article_id(db, group_id, article_id)
     }
   }
 }
+
+long long
+database_sqlite_first_article_id_for_group(db, group_id)
+  database *db;
+  long long group_id;
+{
+  int res;
+  long long article_id;
+
+  res = database_sqlite_prepare(db, first_article_id_stmt, "SELECT first_article_id FROM groups WHERE id = ?");
+  if (res > 0) {
+    return -1;
+  }
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, group_id);
+
+  res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+  article_id = (long long) (res == SQLITE_ROW ? sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0) : 0);
+  sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+
+  return article_id;
+}
+
+/* the newest range backfilled is also where the forward crawl carries on
+ * from, so last_article_id comes up to it; neither mark goes back, so that
+ * replaying an old capture leaves them be */
+int
+database_sqlite_group_set_first_article_id(db, group_id, low, high)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+{
+  int res;
+  res = database_sqlite_prepare(db, set_first_article_id_stmt,
+      "UPDATE groups SET first_article_id = min(coalesce(first_article_id, ?1), ?1), "
+      "last_article_id = max(coalesce(last_article_id, 0), ?2) WHERE id = ?3");
+  if (res > 0) {
+    return -1;
+  }
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, low);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 2, high);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 3, group_id);
+  while (1) {
+    res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+    if (res == SQLITE_DONE) {
+      return 0;
+    }
+    else if (res == SQLITE_BUSY) {
+      fprintf(stderr, "Database is busy.  Sleeping...\n");
+      sleep(1);
+    }
+    else {
+      fprintf(stderr, "Couldn't update group (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      return -1;
+    }
+  }
+}
+
+int
+database_sqlite_add_gap(db, group_id, low, high, reason)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+  const char *reason;
+{
+  int res;
+  res = database_sqlite_prepare(db, add_gap_stmt,
+      "INSERT INTO gaps (group_id, low, high, reason) VALUES (?, ?, ?, ?) "
+      "ON CONFLICT (group_id, low) DO UPDATE SET high = max(high, excluded.high), reason = excluded.reason");
+  if (res > 0) {
+    return -1;
+  }
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, group_id);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 2, low);
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 3, high);
+  sqlite3_bind_text((sqlite3_stmt *)db->s_stmt, 4, reason, strlen(reason), SQLITE_STATIC);
+  while (1) {
+    res = sqlite3_step((sqlite3_stmt *)db->s_stmt);
+    if (res == SQLITE_DONE) {
+      return 0;
+    }
+    else if (res == SQLITE_BUSY) {
+      fprintf(stderr, "Database is busy.  Sleeping...\n");
+      sleep(1);
+    }
+    else {
+      fprintf(stderr, "Couldn't record gap (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+      return -1;
+    }
+  }
+}
+
+/* take low..high out of a group's gaps: the part of a gap above high
+ * becomes a gap of its own, and what's left below low stays */
+int
+database_sqlite_clear_gap(db, group_id, low, high)
+  database *db;
+  long long group_id;
+  long long low;
+  long long high;
+{
+  char sql[1024];
+
+  snprintf(sql, sizeof(sql),
+      "INSERT OR IGNORE INTO gaps SELECT group_id, %lld, high, reason FROM gaps WHERE group_id = %lld AND low <= %lld AND high > %lld;"
+      "DELETE FROM gaps WHERE group_id = %lld AND low >= %lld AND low <= %lld;"
+      "UPDATE gaps SET high = %lld WHERE group_id = %lld AND low < %lld AND high >= %lld;",
+      high + 1, group_id, high, high,
+      group_id, low, high,
+      low - 1, group_id, low, low);
+  if (sqlite3_exec((sqlite3 *)db->s_db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+    fprintf(stderr, "Couldn't clear gap (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    return -1;
+  }
+  return 0;
+}
+
+int
+database_sqlite_gaps_for_group(db, group_id, gaps)
+  database *db;
+  long long group_id;
+  database_gap **gaps;
+{
+  int res, n = 0, size = 16;
+  database_gap *g;
+
+  res = database_sqlite_prepare(db, gaps_stmt, "SELECT low, high FROM gaps WHERE group_id = ? ORDER BY low");
+  if (res > 0) {
+    return -1;
+  }
+  if ((*gaps = (database_gap *)malloc(sizeof(database_gap) * size)) == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  sqlite3_bind_int64((sqlite3_stmt *)db->s_stmt, 1, group_id);
+  while ((res = sqlite3_step((sqlite3_stmt *)db->s_stmt)) == SQLITE_ROW) {
+    if (n == size) {
+      if ((g = (database_gap *)realloc(*gaps, sizeof(database_gap) * size * 2)) == NULL) {
+        perror("realloc");
+        break;
+      }
+      *gaps = g;
+      size *= 2;
+    }
+    (*gaps)[n].low = (long long)sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 0);
+    (*gaps)[n].high = (long long)sqlite3_column_int64((sqlite3_stmt *)db->s_stmt, 1);
+    n++;
+  }
+  sqlite3_reset((sqlite3_stmt *)db->s_stmt);
+  if (res != SQLITE_DONE) {
+    if (res != SQLITE_ROW)
+      fprintf(stderr, "Couldn't read gaps (%s)\n", sqlite3_errmsg((sqlite3 *)db->s_db));
+    free(*gaps);
+    *gaps = NULL;
+    return -1;
+  }
+  return n;
+}
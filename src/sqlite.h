@@ -5,14 +5,39 @@
 #include <unistd.h>
 #include "database.h"
 
+/* keep articles_search in step with articles */
+#define SEARCH_INDEX_TRIGGERS \
+  "CREATE TRIGGER articles_search_insert AFTER INSERT ON articles BEGIN " \
+    "INSERT INTO articles_search (rowid, subject) VALUES (new.id, new.subject); END;" \
+  "CREATE TRIGGER articles_search_delete AFTER DELETE ON articles BEGIN " \
+    "INSERT INTO articles_search (articles_search, rowid, subject) VALUES ('delete', old.id, old.subject); END;"
+
+/* and files_search with files; a file's name never changes */
+#define FILES_SEARCH_TRIGGERS \
+  "CREATE TRIGGER files_search_insert AFTER INSERT ON files BEGIN " \
+    "INSERT INTO files_search (rowid, name) VALUES (new.id, new.name); END;" \
+  "CREATE TRIGGER files_search_delete AFTER DELETE ON files BEGIN " \
+    "INSERT INTO files_search (files_search, rowid, name) VALUES ('delete', old.id, old.name); END;"
+
 database *database_sqlite_open(const char *);
 void database_sqlite_close(database *);
+int database_sqlite_configure(database *, int, const char *, int, int);
+int database_sqlite_create_schema(database *);
+int database_sqlite_migrate(database *);
+int database_sqlite_has_table(database *, const char *);
+int database_sqlite_create_search_index(database *);
 int database_sqlite_prepare(database *db, enum stmt_types stmt_type, const char *sql);
 long long database_sqlite_find_or_create_group(database *, const char *);
 long long database_sqlite_last_article_id_for_group(database *, long long);
 int database_sqlite_begin(database *);
 int database_sqlite_commit(database *);
 long long database_sqlite_insert_article(database *, article *);
+int database_sqlite_insert_articles(database *, article *, int);
 int database_sqlite_group_set_last_article_id(database *, long long, long long);
+long long database_sqlite_first_article_id_for_group(database *, long long);
+int database_sqlite_group_set_first_article_id(database *, long long, long long, long long);
+int database_sqlite_add_gap(database *, long long, long long, long long, const char *);
+int database_sqlite_clear_gap(database *, long long, long long, long long);
+int database_sqlite_gaps_for_group(database *, long long, database_gap **);
 
 #endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+static const char *timer_names[] = {
+  "connect", "auth", "group", "reply", "transfer", "decode", "parse", "insert", "commit"
+};
+static const char *counter_names[] = {
+  "bytes_wire", "bytes_decoded", "articles", "rows", "batches"
+};
+
+static struct {
+  pthread_mutex_t lock;
+  long long count[num_stat_timers];
+  double total[num_stat_timers];
+  double max[num_stat_timers];
+  long long counter[num_stat_counters];
+  double started;
+} stats = { PTHREAD_MUTEX_INITIALIZER };
+
+double
+stats_clock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* start the clock for the run's rates */
+void
+stats_start()
+{
+  pthread_mutex_lock(&stats.lock);
+  stats.started = stats_clock();
+  pthread_mutex_unlock(&stats.lock);
+}
+
+/* time since stats_start, or the first stats call */
+static double
+stats_elapsed()
+{
+  double now = stats_clock();
+
+  if (stats.started == 0)
+    stats.started = now;
+  return now - stats.started;
+}
+
+void
+stats_time(timer, seconds)
+  enum stat_timers timer;
+  double seconds;
+{
+  pthread_mutex_lock(&stats.lock);
+  stats_elapsed();
+  stats.count[timer]++;
+  stats.total[timer] += seconds;
+  if (seconds > stats.max[timer])
+    stats.max[timer] = seconds;
+  pthread_mutex_unlock(&stats.lock);
+}
+
+void
+stats_add(counter, n)
+  enum stat_counters counter;
+  long long n;
+{
+  pthread_mutex_lock(&stats.lock);
+  stats_elapsed();
+  stats.counter[counter] += n;
+  pthread_mutex_unlock(&stats.lock);
+}
+
+/* open filename for writing; "-" is stdout, and anything else is written
+ * to a temporary file that replaces it on stats_close, so readers never
+ * see half a file */
+static FILE *
+stats_open(filename, tmp, size)
+  const char *filename;
+  char *tmp;
+  size_t size;
+{
+  FILE *f;
+
+  if (strcmp(filename, "-") == 0)
+    return stdout;
+  snprintf(tmp, size, "%s.tmp", filename);
+  if ((f = fopen(tmp, "w")) == NULL)
+    fprintf(stderr, "Couldn't open stats file %s.\n", tmp);
+  return f;
+}
+
+static int
+stats_close(f, filename, tmp)
+  FILE *f;
+  const char *filename;
+  const char *tmp;
+{
+  if (f == stdout) {
+    fflush(f);
+    return 0;
+  }
+  if (fclose(f) != 0 || rename(tmp, filename) != 0) {
+    fprintf(stderr, "Couldn't write stats file %s.\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+/* a summary of the whole run */
+int
+stats_write_json(filename)
+  const char *filename;
+{
+  FILE *f;
+  char tmp[1024];
+  int i;
+  double elapsed, db_time;
+
+  if ((f = stats_open(filename, tmp, sizeof(tmp))) == NULL)
+    return 1;
+
+  pthread_mutex_lock(&stats.lock);
+  elapsed = stats_elapsed();
+  db_time = stats.total[stat_insert] + stats.total[stat_commit];
+  fprintf(f, "{\n  \"elapsed\": %.3f,\n  \"timers\": {\n", elapsed);
+  for (i = 0; i < num_stat_timers; i++) {
+    fprintf(f, "    \"%s\": {\"count\": %lld, \"seconds\": %.6f, \"mean\": %.6f, \"max\": %.6f}%s\n",
+        timer_names[i], stats.count[i], stats.total[i],
+        stats.count[i] > 0 ? stats.total[i] / stats.count[i] : 0.0, stats.max[i],
+        i + 1 < num_stat_timers ? "," : "");
+  }
+  fprintf(f, "  },\n  \"counters\": {\n");
+  for (i = 0; i < num_stat_counters; i++) {
+    fprintf(f, "    \"%s\": %lld%s\n", counter_names[i], stats.counter[i], i + 1 < num_stat_counters ? "," : "");
+  }
+  fprintf(f, "  },\n  \"rates\": {\n");
+  fprintf(f, "    \"articles_per_sec\": %.1f,\n", elapsed > 0 ? stats.counter[stat_articles] / elapsed : 0.0);
+  fprintf(f, "    \"rows_per_db_sec\": %.1f,\n", db_time > 0 ? stats.counter[stat_rows] / db_time : 0.0);
+  fprintf(f, "    \"wire_mb_per_sec\": %.3f,\n",
+      stats.total[stat_transfer] > 0 ? stats.counter[stat_bytes_wire] / stats.total[stat_transfer] / 1e6 : 0.0);
+  fprintf(f, "    \"compression_ratio\": %.3f\n",
+      stats.counter[stat_bytes_wire] > 0 ? (double)stats.counter[stat_bytes_decoded] / stats.counter[stat_bytes_wire] : 0.0);
+  fprintf(f, "  }\n}\n");
+  pthread_mutex_unlock(&stats.lock);
+
+  return stats_close(f, filename, tmp);
+}
+
+/* the same in Prometheus' text format, for a node exporter's textfile
+ * collector */
+int
+stats_write_prometheus(filename)
+  const char *filename;
+{
+  FILE *f;
+  char tmp[1024];
+  int i;
+
+  if ((f = stats_open(filename, tmp, sizeof(tmp))) == NULL)
+    return 1;
+
+  pthread_mutex_lock(&stats.lock);
+  fprintf(f, "# HELP pwnntp_uptime_seconds Time since the crawl started.\n");
+  fprintf(f, "# TYPE pwnntp_uptime_seconds gauge\n");
+  fprintf(f, "pwnntp_uptime_seconds %.3f\n", stats_elapsed());
+  fprintf(f, "# HELP pwnntp_phase_seconds_total Time spent in each phase.\n");
+  fprintf(f, "# TYPE pwnntp_phase_seconds_total counter\n");
+  for (i = 0; i < num_stat_timers; i++)
+    fprintf(f, "pwnntp_phase_seconds_total{phase=\"%s\"} %.6f\n", timer_names[i], stats.total[i]);
+  fprintf(f, "# HELP pwnntp_phase_count_total Times each phase ran.\n");
+  fprintf(f, "# TYPE pwnntp_phase_count_total counter\n");
+  for (i = 0; i < num_stat_timers; i++)
+    fprintf(f, "pwnntp_phase_count_total{phase=\"%s\"} %lld\n", timer_names[i], stats.count[i]);
+  fprintf(f, "# HELP pwnntp_phase_max_seconds Longest single run of each phase.\n");
+  fprintf(f, "# TYPE pwnntp_phase_max_seconds gauge\n");
+  for (i = 0; i < num_stat_timers; i++)
+    fprintf(f, "pwnntp_phase_max_seconds{phase=\"%s\"} %.6f\n", timer_names[i], stats.max[i]);
+  for (i = 0; i < num_stat_counters; i++) {
+    fprintf(f, "# TYPE pwnntp_%s_total counter\n", counter_names[i]);
+    fprintf(f, "pwnntp_%s_total %lld\n", counter_names[i], stats.counter[i]);
+  }
+  pthread_mutex_unlock(&stats.lock);
+
+  return stats_close(f, filename, tmp);
+}
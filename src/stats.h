@@ -0,0 +1,36 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+/* seconds between rewrites of the metrics file in long runs */
+#define STATS_INTERVAL 15
+
+enum stat_timers {
+  stat_connect,             /* TCP connect and TLS handshake */
+  stat_auth,                /* greeting and AUTHINFO */
+  stat_group,               /* GROUP round trips */
+  stat_reply,               /* waiting for a reply's status line */
+  stat_transfer,            /* reading a reply's data block */
+  stat_decode,              /* yEnc and inflate */
+  stat_parse,               /* header records into articles */
+  stat_insert,              /* sqlite inserts */
+  stat_commit,              /* sqlite commits */
+  num_stat_timers
+};
+
+enum stat_counters {
+  stat_bytes_wire,          /* data block bytes as received */
+  stat_bytes_decoded,       /* the same, decompressed */
+  stat_articles,            /* articles parsed */
+  stat_rows,                /* articles written */
+  stat_batches,             /* ranges written */
+  num_stat_counters
+};
+
+double stats_clock();
+void stats_start();
+void stats_time(enum stat_timers, double);
+void stats_add(enum stat_counters, long long);
+int stats_write_json(const char *);
+int stats_write_prometheus(const char *);
+
+#endif
@@ -0,0 +1,54 @@
+#include "subject.h"
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' || (c) == '\f' || (c) == '\v')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+/* read the number that ends just before *end, moving end back over it */
+static int
+subject_number(s, end, n)
+  const char *s;
+  int *end;
+  int *n;
+{
+  int i = *end, mul = 1;
+
+  *n = 0;
+  while (i > 0 && IS_DIGIT(s[i - 1]) && mul <= 100000000) {
+    *n += (s[i - 1] - '0') * mul;
+    mul *= 10;
+    i--;
+  }
+  if (i == *end || (i > 0 && IS_DIGIT(s[i - 1])))
+    return 0;
+  *end = i;
+  return 1;
+}
+
+/* the same split create-nzb.rb made with /(.*\S)\s*\((\d+)\/(\d+)\)\s*$/,
+ * done backwards from the end of the subject */
+int
+subject_parse(s, len, nlen, part, total)
+  const char *s;
+  int len;
+  int *nlen;
+  int *part;
+  int *total;
+{
+  int i = len;
+
+  while (i > 0 && IS_SPACE(s[i - 1]))
+    i--;
+  if (i == 0 || s[--i] != ')')
+    return 0;
+  if (!subject_number(s, &i, total) || i == 0 || s[--i] != '/')
+    return 0;
+  if (!subject_number(s, &i, part) || i == 0 || s[--i] != '(')
+    return 0;
+
+  while (i > 0 && IS_SPACE(s[i - 1]))
+    i--;
+  if (i == 0)
+    return 0;
+  *nlen = i;
+  return 1;
+}
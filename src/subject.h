@@ -0,0 +1,9 @@
+#ifndef _SUBJECT_H
+#define _SUBJECT_H
+
+/* Split a "name (part/total)" subject.  Returns 1 and sets the length of
+ * the name (which starts the subject, trailing spaces dropped), the part
+ * and the total if the subject ends in a part counter, 0 otherwise. */
+int subject_parse(const char *, int, int *, int *, int *);
+
+#endif
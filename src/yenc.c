@@ -0,0 +1,225 @@
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "yenc.h"
+
+/* decode one byte, or one escape sequence, of a line; returns 1 when p is
+ * at a "=yend" trailer */
+static inline int
+yenc_step(pp, e, op, bol)
+  const unsigned char **pp;
+  const unsigned char *e;
+  unsigned char **op;
+  int *bol;
+{
+  const unsigned char *p = *pp;
+
+  switch (*p) {
+    case '\n':
+      *bol = 1;
+      /* fall through */
+    case '\r':
+      *pp = p + 1;
+      return 0;
+
+    case '=':
+      if (*bol && e - p >= 5 && memcmp(p, "=yend", 5) == 0)
+        return 1;
+      if (e - p >= 2)
+        *(*op)++ = p[1] - '@' - 42;
+      *pp = p + 2 > e ? e : p + 2;
+      *bol = 0;
+      return 0;
+
+    default:
+      *(*op)++ = *p - 42;
+      *pp = p + 1;
+      *bol = 0;
+      return 0;
+  }
+}
+
+size_t
+yenc_decode_scalar(out, in, len, consumed, end)
+  unsigned char *out;
+  const char *in;
+  size_t len;
+  size_t *consumed;
+  int *end;
+{
+  const unsigned char *p = (const unsigned char *)in, *e = p + len;
+  unsigned char *o = out;
+  int bol = 1;
+
+  *end = 0;
+  while (p < e) {
+    if (yenc_step(&p, e, &o, &bol)) {
+      *end = 1;
+      break;
+    }
+  }
+  *consumed = p - (const unsigned char *)in;
+  return o - out;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The vector versions decode plain runs a register at a time and leave
+ * '=', CR and LF to yenc_step().  A full register is always stored, but
+ * since the output never gets ahead of the input, it stays inside out. */
+__attribute__((target("sse2")))
+size_t
+yenc_decode_sse2(out, in, len, consumed, end)
+  unsigned char *out;
+  const char *in;
+  size_t len;
+  size_t *consumed;
+  int *end;
+{
+  const unsigned char *p = (const unsigned char *)in, *e = p + len;
+  unsigned char *o = out;
+  const __m128i eq = _mm_set1_epi8('='), cr = _mm_set1_epi8('\r'),
+        lf = _mm_set1_epi8('\n'), off = _mm_set1_epi8(42);
+  __m128i v;
+  unsigned int mask, n;
+  int bol = 1;
+
+  *end = 0;
+  while (p < e) {
+    if (e - p >= 16) {
+      v = _mm_loadu_si128((const __m128i *)p);
+      mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, eq),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))));
+      _mm_storeu_si128((__m128i *)o, _mm_sub_epi8(v, off));
+      n = mask == 0 ? 16 : __builtin_ctz(mask);
+      if (n > 0) {
+        o += n;
+        p += n;
+        bol = 0;
+        continue;
+      }
+    }
+    if (yenc_step(&p, e, &o, &bol)) {
+      *end = 1;
+      break;
+    }
+  }
+  *consumed = p - (const unsigned char *)in;
+  return o - out;
+}
+
+__attribute__((target("avx2")))
+size_t
+yenc_decode_avx2(out, in, len, consumed, end)
+  unsigned char *out;
+  const char *in;
+  size_t len;
+  size_t *consumed;
+  int *end;
+{
+  const unsigned char *p = (const unsigned char *)in, *e = p + len;
+  unsigned char *o = out;
+  const __m256i eq = _mm256_set1_epi8('='), cr = _mm256_set1_epi8('\r'),
+        lf = _mm256_set1_epi8('\n'), off = _mm256_set1_epi8(42);
+  __m256i v;
+  unsigned int mask, n;
+  int bol = 1;
+
+  *end = 0;
+  while (p < e) {
+    if (e - p >= 32) {
+      v = _mm256_loadu_si256((const __m256i *)p);
+      mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, eq),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf))));
+      _mm256_storeu_si256((__m256i *)o, _mm256_sub_epi8(v, off));
+      n = mask == 0 ? 32 : __builtin_ctz(mask);
+      if (n > 0) {
+        o += n;
+        p += n;
+        bol = 0;
+        continue;
+      }
+    }
+    if (yenc_step(&p, e, &o, &bol)) {
+      *end = 1;
+      break;
+    }
+  }
+  *consumed = p - (const unsigned char *)in;
+  return o - out;
+}
+#endif
+
+static yenc_decoder yenc_best = yenc_decode_scalar;
+static const char *yenc_best_name = "scalar";
+static pthread_once_t yenc_once = PTHREAD_ONCE_INIT;
+
+/* pick the widest implementation this CPU supports */
+static void
+yenc_dispatch()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    yenc_best = yenc_decode_avx2;
+    yenc_best_name = "avx2";
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    yenc_best = yenc_decode_sse2;
+    yenc_best_name = "sse2";
+  }
+#endif
+}
+
+size_t
+yenc_decode(out, in, len, consumed, end)
+  unsigned char *out;
+  const char *in;
+  size_t len;
+  size_t *consumed;
+  int *end;
+{
+  pthread_once(&yenc_once, yenc_dispatch);
+  return yenc_best(out, in, len, consumed, end);
+}
+
+const char *
+yenc_impl()
+{
+  pthread_once(&yenc_once, yenc_dispatch);
+  return yenc_best_name;
+}
+
+/* encode len bytes into lines of line characters, escaping NUL, CR, LF and
+ * '=', and the tab, space and '.' that would otherwise start a line (the
+ * last so NNTP dot-stuffing never applies); out needs room for
+ * 2 * len + 2 * (len / line + 1) bytes.  Returns the number written; the
+ * last line isn't terminated. */
+size_t
+yenc_encode(out, in, len, line)
+  char *out;
+  const unsigned char *in;
+  size_t len;
+  int line;
+{
+  size_t i, n = 0;
+  int col = 0;
+  unsigned char c;
+
+  for (i = 0; i < len; i++) {
+    c = in[i] + 42;
+    if (c == 0 || c == '\n' || c == '\r' || c == '=' || (col == 0 && (c == '.' || c == '\t' || c == ' '))) {
+      out[n++] = '=';
+      c += 64;
+      col++;
+    }
+    out[n++] = (char)c;
+    if (++col >= line) {
+      out[n++] = '\r';
+      out[n++] = '\n';
+      col = 0;
+    }
+  }
+  return n;
+}
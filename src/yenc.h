@@ -0,0 +1,22 @@
+#ifndef _YENC_H
+#define _YENC_H
+
+#include <stddef.h>
+
+/* Decode yEnc data that starts at the beginning of a line into out, which
+ * must have room for len bytes.  Line endings are dropped, and decoding
+ * stops in front of a "=yend" trailer line, in which case *end is set.
+ * Returns the number of bytes written; *consumed is set to the number of
+ * input bytes used. */
+typedef size_t (*yenc_decoder)(unsigned char *, const char *, size_t, size_t *, int *);
+
+size_t yenc_decode(unsigned char *, const char *, size_t, size_t *, int *);
+size_t yenc_decode_scalar(unsigned char *, const char *, size_t, size_t *, int *);
+#if defined(__x86_64__) || defined(__i386__)
+size_t yenc_decode_sse2(unsigned char *, const char *, size_t, size_t *, int *);
+size_t yenc_decode_avx2(unsigned char *, const char *, size_t, size_t *, int *);
+#endif
+const char *yenc_impl();
+size_t yenc_encode(char *, const unsigned char *, size_t, int);
+
+#endif